@@ -37,6 +37,8 @@ limitations under the License.
 #include <iostream>
 #include <fstream>
 #include <unistd.h>
+#include <cstdio>
+#include <cstdint>
 
 #include "ast.h"
 #include "cgen.h"
@@ -56,7 +58,61 @@ extern cool::Program *gASTRoot;          // AST produced by parser
 namespace {
 
 void usage(const char *program) {
-  std::cerr << "Usage: " << program << " [-crgtTO] [-o file]" << std::endl;
+  std::cerr << "Usage: " << program << " [-crgtTR] [-O[0|1|2|s]] [-f flag=value] [-o file]" << std::endl;
+}
+
+// -f flags tune individual optimizations
+bool set_cgen_flag(const std::string& flag) {
+  auto eq = flag.find('=');
+  std::string name = flag.substr(0, eq);
+  std::string value = (eq == std::string::npos) ? "" : flag.substr(eq + 1);
+  if (name == "inline-growth" && !value.empty()) {  // max. bytes added by inlining
+    cgen_inline_growth = std::stoi(value);
+    return true;
+  }
+  if (name == "value-numbering" && (value == "0" || value == "1")) {  // same as enable/disable=lvn
+    return cool::CgenSetPass("lvn", value == "1");
+  }
+  if (name == "enable" || name == "disable") {  // a pass, whatever the -O level (see cgen_passes.cc)
+    return cool::CgenSetPass(value, name == "enable");
+  }
+  if (name == "dump-after") {  // the AST after a program pass, to stderr
+    return cool::CgenSetDumpAfter(value);
+  }
+  if (name == "tagged" && (value == "0" || value == "1")) {  // Ints & Bools in pointer words
+    cgen_tagged = (value == "1");
+    return true;
+  }
+  if (name == "profile-generate" && (value.empty() || value == "1")) {  // count into appvar COOLPROF
+    cgen_profile_generate = true;
+    return true;
+  }
+  if (name == "profile-use" && !value.empty()) {  // optimize with a COOLPROF sent from the calculator
+    static std::string profile_use;
+    profile_use = value;
+    cgen_profile_use = profile_use.c_str();
+    return true;
+  }
+  if (name == "iy-flags" && (value == "0" || value == "1")) {  // frame pointer in memory, IY = flags
+    cgen_iy_flags = (value == "1");
+    return true;
+  }
+  if (name == "int-cache") {  // preallocated Ints, LO..HI (0 for none)
+    int low, high;
+    char end;
+    if (value == "0") {
+      cgen_int_cache_low = 0;
+      cgen_int_cache_high = -1;
+      return true;
+    }
+    if (sscanf(value.c_str(), "%d..%d%c", &low, &high, &end) == 2 && low >= INT16_MIN && high <= INT16_MAX
+        && low <= high && high - low < 4096) {
+      cgen_int_cache_low = low;
+      cgen_int_cache_high = high;
+      return true;
+    }
+  }
+  return false;
 }
 }
 
@@ -66,7 +122,7 @@ int main(int argc, char *argv[]) {
 
   int c;
   opterr = 0;  // getopt shouldn't print any messages
-  while ((c = getopt(argc, argv, "lpscrgtTOo:h")) != -1) {
+  while ((c = getopt(argc, argv, "lpscrgtTO::Rf:o:h")) != -1) {
     switch (c) {
 #ifdef DEBUG
       case 'l':
@@ -94,8 +150,20 @@ int main(int argc, char *argv[]) {
       case 'o':  // set the name of the output file
         out_filename = optarg;
         break;
-      case 'O':  // enable optimization
-        cgen_optimize = true;
+      case 'O':  // optimization level, -O being -O2
+        if (!cool::CgenSetLevel(optarg != nullptr ? optarg : "2")) {
+          usage(argv[0]);
+          return 85;
+        }
+        break;
+      case 'R':  // report optimization statistics
+        cgen_report = true;
+        break;
+      case 'f':  // tune optimizations
+        if (!set_cgen_flag(optarg)) {
+          usage(argv[0]);
+          return 85;
+        }
         break;
       case 'h':
         usage(argv[0]);
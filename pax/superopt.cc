@@ -0,0 +1,900 @@
+/* superopt.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * superoptimizer for fixed instruction sequences of the code generator. Each
+ * pattern is the sequence emit.cc or cgen.cc writes, the registers and flags
+ * whose values matter afterwards, and the instructions to search over. All
+ * sequences of those instructions cheaper than the original (in bytes, then
+ * T-states) are tried, cheapest first, by running them on a model of the Z80's
+ * registers, flags, stack and memory; a sequence that agrees with the original
+ * on a set of test states is checked against many more before it's accepted.
+ *
+ * Writes the table of replacements (src/emit_templates.cc) to stdout and a
+ * report to stderr:
+ *   superopt > src/emit_templates.cc
+ * or, to try out only some of the patterns:
+ *   superopt "sub hl,bc" "neg hl"
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum Reg { A, F, B, C, D, E, H, L, kRegs };
+enum Pair { BC, DE, HL, AF };
+const char* const kRegNames[] = { "a", "f", "b", "c", "d", "e", "h", "l" };
+const char* const kPairNames[] = { "bc", "de", "hl", "af" };
+
+// flag bits (3 and 5 are undocumented, and never live)
+const uint8_t FS = 0x80, FZ = 0x40, FH = 0x10, FPV = 0x04, FN = 0x02, FC = 0x01;
+
+const uint16_t kStackTop = 0xF000;       // SP on entry; below it is free stack space
+const uint16_t kStackSpace = 0x100;
+const int kMaxWrites = 12;
+
+uint8_t Hash(uint32_t seed, uint16_t addr) {
+	uint32_t x = seed ^ (addr * 2654435761u);
+	x ^= x >> 15;
+	x *= 2246822519u;
+	x ^= x >> 13;
+	return x >> 24;
+}
+
+struct State {
+	uint8_t r[kRegs];
+	uint16_t sp;
+	uint32_t seed;       // memory that hasn't been written holds Hash(seed, address) & mask
+	uint8_t mask;
+	int writes;
+	uint16_t waddr[kMaxWrites];
+	uint8_t wval[kMaxWrites];
+	bool overflow;       // too many writes to model
+
+	uint16_t Get(Pair p) const {
+		static const Reg high[] = { B, D, H, A }, low[] = { C, E, L, F };
+		return (r[high[p]] << 8) | r[low[p]];
+	}
+	void Set(Pair p, uint16_t v) {
+		static const Reg high[] = { B, D, H, A }, low[] = { C, E, L, F };
+		r[high[p]] = v >> 8;
+		r[low[p]] = v & 0xFF;
+	}
+	uint8_t Read(uint16_t addr) const {
+		for (int i = 0; i < writes; ++i) {
+			if (waddr[i] == addr) {
+				return wval[i];
+			}
+		}
+		return Hash(seed, addr) & mask;
+	}
+	void Write(uint16_t addr, uint8_t v) {
+		for (int i = 0; i < writes; ++i) {
+			if (waddr[i] == addr) {
+				wval[i] = v;
+				return;
+			}
+		}
+		if (writes == kMaxWrites) {
+			overflow = true;
+			return;
+		}
+		waddr[writes] = addr;
+		wval[writes++] = v;
+	}
+	uint64_t Fingerprint() const {
+		uint64_t h = 1469598103934665603ull;
+		for (int i = 0; i < kRegs; ++i) {
+			h = (h ^ r[i]) * 1099511628211ull;
+		}
+		h = (h ^ sp) * 1099511628211ull;
+		uint64_t mem = 0; // order of writes doesn't matter
+		for (int i = 0; i < writes; ++i) {
+			if (wval[i] != (Hash(seed, waddr[i]) & mask)) {
+				mem += ((uint64_t(waddr[i]) << 8 | wval[i]) + 1) * 0x9E3779B97F4A7C15ull;
+			}
+		}
+		return h ^ mem;
+	}
+};
+
+uint8_t Parity(uint8_t v) {
+	v ^= v >> 4;
+	v ^= v >> 2;
+	v ^= v >> 1;
+	return (v & 1) ? 0 : FPV;
+}
+
+uint8_t SZ(uint8_t v) {
+	return (v & 0x80) | (v == 0 ? FZ : 0) | (v & 0x28);
+}
+
+enum Kind {
+	LD_R_R, LD_R_N, LD_RR_NN, LD_R_IHL, LD_IHL_R, INC_R, DEC_R, INC_RR, DEC_RR, ALU_R, ALU_N, ALU_IHL,
+	ADD_HL, ADC_HL, SBC_HL, CPL, NEG, SCF, CCF, RLA, RRA, RLCA, RRCA, ROT_R, EX_DE_HL, PUSH, POP, JR
+};
+enum Alu { ADD, ADC, SUB, SBC, AND, XOR, OR, CP };
+const char* const kAluNames[] = { "add\ta,", "adc\ta,", "sub\t", "sbc\ta,", "and\t", "xor\t", "or\t", "cp\t" };
+enum Rot { RL, RR, SLA, SRA, SRL };
+const char* const kRotNames[] = { "rl", "rr", "sla", "sra", "srl" };
+enum Cond { NZ, Z, NC, CY };
+const char* const kCondNames[] = { "nz", "z", "nc", "c" };
+
+struct Op {
+	Kind kind;
+	int x = 0;      // register, pair, ALU operation, rotation or condition
+	int y = 0;      // source register
+	int n = 0;      // immediate, or instructions skipped by jr
+
+	int Bytes() const {
+		switch (kind) {
+		case LD_R_N: case ALU_N: case ADC_HL: case SBC_HL: case NEG: case ROT_R: case JR:
+			return 2;
+		case LD_RR_NN:
+			return 3;
+		default:
+			return 1;
+		}
+	}
+	int Cycles(bool taken = true) const {
+		switch (kind) {
+		case LD_R_R: case INC_R: case DEC_R: case ALU_R: case CPL: case SCF: case CCF:
+		case RLA: case RRA: case RLCA: case RRCA: case EX_DE_HL:
+			return 4;
+		case LD_R_N: case LD_R_IHL: case LD_IHL_R: case ALU_N: case ALU_IHL:
+			return 7;
+		case LD_RR_NN: case POP:
+			return 10;
+		case INC_RR: case DEC_RR:
+			return 6;
+		case ADD_HL: case PUSH:
+			return 11;
+		case ADC_HL: case SBC_HL:
+			return 15;
+		case NEG: case ROT_R:
+			return 8;
+		case JR:
+			return taken ? 12 : 7;
+		}
+		return 0;
+	}
+	// bytes, then T-states (not taken, for jr)
+	int Cost() const {
+		return Bytes() * 256 + Cycles(false);
+	}
+	std::string Text() const {
+		std::ostringstream os;
+		os << "\t";
+		switch (kind) {
+		case LD_R_R:   os << "ld\t" << kRegNames[x] << "," << kRegNames[y]; break;
+		case LD_R_N:   os << "ld\t" << kRegNames[x] << "," << n; break;
+		case LD_RR_NN: os << "ld\t" << kPairNames[x] << "," << n; break;
+		case LD_R_IHL: os << "ld\t" << kRegNames[x] << ",(hl)"; break;
+		case LD_IHL_R: os << "ld\t(hl)," << kRegNames[x]; break;
+		case INC_R:    os << "inc\t" << kRegNames[x]; break;
+		case DEC_R:    os << "dec\t" << kRegNames[x]; break;
+		case INC_RR:   os << "inc\t" << kPairNames[x]; break;
+		case DEC_RR:   os << "dec\t" << kPairNames[x]; break;
+		case ALU_R:    os << kAluNames[x] << kRegNames[y]; break;
+		case ALU_N:    os << kAluNames[x] << n; break;
+		case ALU_IHL:  os << kAluNames[x] << "(hl)"; break;
+		case ADD_HL:   os << "add\thl," << kPairNames[x]; break;
+		case ADC_HL:   os << "adc\thl," << kPairNames[x]; break;
+		case SBC_HL:   os << "sbc\thl," << kPairNames[x]; break;
+		case CPL:      os << "cpl"; break;
+		case NEG:      os << "neg"; break;
+		case SCF:      os << "scf"; break;
+		case CCF:      os << "ccf"; break;
+		case RLA:      os << "rla"; break;
+		case RRA:      os << "rra"; break;
+		case RLCA:     os << "rlca"; break;
+		case RRCA:     os << "rrca"; break;
+		case ROT_R:    os << kRotNames[x] << "\t" << kRegNames[y]; break;
+		case EX_DE_HL: os << "ex\tde,hl"; break;
+		case PUSH:     os << "push\t" << kPairNames[x]; break;
+		case POP:      os << "pop\t" << kPairNames[x]; break;
+		case JR:       os << "jr\t" << kCondNames[x] << ",$+" << n; break;
+		}
+		return os.str();
+	}
+};
+
+Op MakeOp(Kind kind, int x = 0, int y = 0, int n = 0) {
+	Op op;
+	op.kind = kind;
+	op.x = x;
+	op.y = y;
+	op.n = n;
+	return op;
+}
+
+void DoAlu(State& s, int alu, uint8_t v) {
+	const uint8_t a = s.r[A];
+	const int carry = s.r[F] & FC;
+	int result;
+	switch (alu) {
+	case ADD: case ADC: {
+		const int c = (alu == ADC) ? carry : 0;
+		result = a + v + c;
+		const uint8_t r = result;
+		s.r[F] = SZ(r) | (((a & 0xF) + (v & 0xF) + c) > 0xF ? FH : 0)
+			| ((~(a ^ v) & (a ^ r) & 0x80) ? FPV : 0) | (result > 0xFF ? FC : 0);
+		s.r[A] = r;
+		return;
+	}
+	case SUB: case SBC: case CP: {
+		const int c = (alu == SBC) ? carry : 0;
+		result = a - v - c;
+		const uint8_t r = result;
+		s.r[F] = SZ(r) | ((a & 0xF) < (v & 0xF) + c ? FH : 0) | (((a ^ v) & (a ^ r) & 0x80) ? FPV : 0)
+			| FN | (result < 0 ? FC : 0);
+		if (alu == CP) {
+			s.r[F] = (s.r[F] & ~0x28) | (v & 0x28);
+		} else {
+			s.r[A] = r;
+		}
+		return;
+	}
+	case AND:
+		s.r[A] = a & v;
+		s.r[F] = SZ(s.r[A]) | FH | Parity(s.r[A]);
+		return;
+	case XOR:
+		s.r[A] = a ^ v;
+		s.r[F] = SZ(s.r[A]) | Parity(s.r[A]);
+		return;
+	case OR:
+		s.r[A] = a | v;
+		s.r[F] = SZ(s.r[A]) | Parity(s.r[A]);
+		return;
+	}
+}
+
+// runs op on s; returns the number of following instructions skipped
+int Step(const Op& op, State& s) {
+	uint8_t& f = s.r[F];
+	switch (op.kind) {
+	case LD_R_R:
+		s.r[op.x] = s.r[op.y];
+		break;
+	case LD_R_N:
+		s.r[op.x] = op.n;
+		break;
+	case LD_RR_NN:
+		s.Set(Pair(op.x), op.n);
+		break;
+	case LD_R_IHL:
+		s.r[op.x] = s.Read(s.Get(HL));
+		break;
+	case LD_IHL_R:
+		s.Write(s.Get(HL), s.r[op.x]);
+		break;
+	case INC_R: {
+		const uint8_t r = ++s.r[op.x];
+		f = (f & FC) | SZ(r) | ((r & 0xF) == 0 ? FH : 0) | (r == 0x80 ? FPV : 0);
+		break;
+	}
+	case DEC_R: {
+		const uint8_t r = --s.r[op.x];
+		f = (f & FC) | SZ(r) | ((r & 0xF) == 0xF ? FH : 0) | (r == 0x7F ? FPV : 0) | FN;
+		break;
+	}
+	case INC_RR:
+		s.Set(Pair(op.x), s.Get(Pair(op.x)) + 1);
+		break;
+	case DEC_RR:
+		s.Set(Pair(op.x), s.Get(Pair(op.x)) - 1);
+		break;
+	case ALU_R:
+		DoAlu(s, op.x, s.r[op.y]);
+		break;
+	case ALU_N:
+		DoAlu(s, op.x, op.n);
+		break;
+	case ALU_IHL:
+		DoAlu(s, op.x, s.Read(s.Get(HL)));
+		break;
+	case ADD_HL: {
+		const uint32_t hl = s.Get(HL), v = s.Get(Pair(op.x)), result = hl + v;
+		f = (f & (FS | FZ | FPV)) | (((hl & 0xFFF) + (v & 0xFFF)) > 0xFFF ? FH : 0)
+			| ((result >> 8) & 0x28) | (result > 0xFFFF ? FC : 0);
+		s.Set(HL, result);
+		break;
+	}
+	case ADC_HL: case SBC_HL: {
+		const int hl = s.Get(HL), v = s.Get(Pair(op.x)), c = f & FC;
+		const bool sub = (op.kind == SBC_HL);
+		const int result = sub ? hl - v - c : hl + v + c;
+		const uint16_t r = result;
+		const bool overflow = sub ? ((hl ^ v) & (hl ^ r) & 0x8000) : (~(hl ^ v) & (hl ^ r) & 0x8000);
+		const bool half = sub ? (hl & 0xFFF) < (v & 0xFFF) + c : ((hl & 0xFFF) + (v & 0xFFF) + c) > 0xFFF;
+		f = ((r >> 8) & (FS | 0x28)) | (r == 0 ? FZ : 0) | (half ? FH : 0) | (overflow ? FPV : 0)
+			| (sub ? FN : 0) | ((result < 0 || result > 0xFFFF) ? FC : 0);
+		s.Set(HL, r);
+		break;
+	}
+	case CPL:
+		s.r[A] = ~s.r[A];
+		f = (f & (FS | FZ | FPV | FC)) | FH | FN | (s.r[A] & 0x28);
+		break;
+	case NEG: {
+		const uint8_t a = s.r[A];
+		s.r[A] = 0;
+		DoAlu(s, SUB, a);
+		break;
+	}
+	case SCF:
+		f = (f & (FS | FZ | FPV)) | (s.r[A] & 0x28) | FC;
+		break;
+	case CCF:
+		f = ((f & (FS | FZ | FPV | FC)) | (s.r[A] & 0x28) | ((f & FC) ? FH : 0)) ^ FC;
+		break;
+	case RLA: case RRA: case RLCA: case RRCA: {
+		const uint8_t a = s.r[A];
+		const int carry_in = (op.kind == RLA || op.kind == RRA) ? (f & FC) : -1;
+		uint8_t carry;
+		if (op.kind == RLA || op.kind == RLCA) {
+			carry = a >> 7;
+			s.r[A] = (a << 1) | (carry_in < 0 ? carry : carry_in);
+		} else {
+			carry = a & 1;
+			s.r[A] = (a >> 1) | ((carry_in < 0 ? carry : carry_in) << 7);
+		}
+		f = (f & (FS | FZ | FPV)) | (s.r[A] & 0x28) | carry;
+		break;
+	}
+	case ROT_R: {
+		const uint8_t v = s.r[op.y];
+		uint8_t r, carry;
+		switch (op.x) {
+		case RL:  r = (v << 1) | (f & FC); carry = v >> 7; break;
+		case RR:  r = (v >> 1) | ((f & FC) << 7); carry = v & 1; break;
+		case SLA: r = v << 1; carry = v >> 7; break;
+		case SRA: r = (v >> 1) | (v & 0x80); carry = v & 1; break;
+		default:  r = v >> 1; carry = v & 1; break;
+		}
+		s.r[op.y] = r;
+		f = SZ(r) | Parity(r) | carry;
+		break;
+	}
+	case EX_DE_HL: {
+		const uint16_t de = s.Get(DE);
+		s.Set(DE, s.Get(HL));
+		s.Set(HL, de);
+		break;
+	}
+	case PUSH: {
+		const uint16_t v = s.Get(Pair(op.x));
+		s.sp -= 2;
+		s.Write(s.sp, v & 0xFF);
+		s.Write(s.sp + 1, v >> 8);
+		break;
+	}
+	case POP:
+		s.Set(Pair(op.x), s.Read(s.sp) | (s.Read(s.sp + 1) << 8));
+		s.sp += 2;
+		break;
+	case JR: {
+		static const uint8_t mask[] = { FZ, FZ, FC, FC };
+		const bool set = (f & mask[op.x]) != 0;
+		return (set == (op.x == Z || op.x == CY)) ? op.n : 0;
+	}
+	}
+	return 0;
+}
+
+// runs code from s; returns its T-states
+int Run(const std::vector<Op>& code, State& s) {
+	int cycles = 0;
+	for (std::size_t i = 0; i < code.size(); ++i) {
+		const int skip = Step(code[i], s);
+		cycles += code[i].Cycles(skip > 0);
+		i += skip;
+	}
+	return cycles;
+}
+
+struct Pattern {
+	std::string key;          // how emit.cc looks the replacement up
+	std::vector<Op> original;
+	std::vector<Reg> live;    // registers whose values are used afterwards
+	uint8_t live_flags;
+	bool hl_pointer;          // HL points to an object on entry (not into the stack)
+	std::vector<Op> alphabet; // instructions to search over
+};
+
+uint32_t gRandom = 2463534242u;
+
+uint32_t Random() {
+	gRandom ^= gRandom << 13;
+	gRandom ^= gRandom >> 17;
+	gRandom ^= gRandom << 5;
+	return gRandom;
+}
+
+// index picks the kind of state: edge values, equal or adjacent register pairs, and memory that is
+// all zeros or holds single bits, so that comparisons and tests for zero go both ways
+State RandomState(const Pattern& p, int index) {
+	static const uint16_t edges[] = { 0x0000, 0x0001, 0x7FFF, 0x8000, 0xFFFF, 0x00FF, 0x0100, 0xFF00 };
+	static const uint8_t masks[] = { 0xFF, 0x00, 0x01, 0x80 };
+	State s;
+	memset(&s, 0, sizeof(s));
+	for (int i = 0; i < kRegs; ++i) {
+		s.r[i] = Random();
+	}
+	if (index % 3 == 0) {
+		s.Set(BC, edges[index % 8]);
+		s.Set(DE, edges[(index * 3 + 1) % 8]);
+		s.Set(HL, edges[(index * 5 + 2) % 8]);
+	}
+	if (p.hl_pointer) {
+		s.Set(HL, 0x8000 + Random() % 0x6000);
+	}
+	switch (index % 5) {
+	case 1: s.Set(BC, s.Get(HL)); break;
+	case 2: s.Set(DE, s.Get(HL)); break;
+	case 3: s.Set(BC, s.Get(HL) + 1); break;
+	case 4: s.Set(BC, s.Get(HL) - 1); break;
+	}
+	s.r[F] = (s.r[F] & ~FC) | ((index >> 1) & 1);
+	s.sp = kStackTop;
+	s.seed = Random();
+	s.mask = masks[(index / 5) % 4];
+	return s;
+}
+
+// result of code agrees with expected on what the pattern says is live
+bool Same(const Pattern& p, const State& expected, const State& result) {
+	if (result.overflow || result.sp != expected.sp) {
+		return false;
+	}
+	for (Reg reg : p.live) {
+		if (expected.r[reg] != result.r[reg]) {
+			return false;
+		}
+	}
+	if ((expected.r[F] ^ result.r[F]) & p.live_flags) {
+		return false;
+	}
+	// memory outside the free stack space
+	auto outside = [](uint16_t addr) { return addr >= kStackTop || addr < kStackTop - kStackSpace; };
+	for (const State* s : { &expected, &result }) {
+		for (int i = 0; i < s->writes; ++i) {
+			if (outside(s->waddr[i]) && expected.Read(s->waddr[i]) != result.Read(s->waddr[i])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+class Search {
+ public:
+	explicit Search(const Pattern& p) : p_(p), memo_(kMemoSize) {
+		for (int i = 0; i < kTests; ++i) {
+			inputs_.push_back(RandomState(p, i));
+			expected_.push_back(inputs_.back());
+			Run(p.original, expected_.back());
+		}
+		best_cost_ = Cost(p.original);
+	}
+
+	/// Finds the cheapest sequence equivalent to the original, by iterative deepening on its size
+	/// \return false if there's none cheaper than the original
+	bool Find() {
+		const int original_bytes = best_cost_ / 256;
+		levels_.assign(original_bytes, inputs_); // every instruction is at least a byte
+		for (int bytes = 1; bytes <= original_bytes && best_.empty() && !exhausted(); ++bytes) {
+			bound_ = std::min(best_cost_, (bytes + 1) * 256);
+			std::fill(memo_.begin(), memo_.end(), std::make_pair(uint64_t(0), 0));
+			std::vector<Op> code;
+			Dfs(inputs_, code, 0);
+		}
+		return !best_.empty();
+	}
+
+	const std::vector<Op>& best() const { return best_; }
+	long nodes() const { return nodes_; }
+	bool exhausted() const { return nodes_ >= kMaxNodes; }
+
+	static int Cost(const std::vector<Op>& code) {
+		int cost = 0;
+		for (const Op& op : code) {
+			cost += op.Cost();
+		}
+		return cost;
+	}
+
+ private:
+	static const int kTests = 10;
+	static const int kVerifications = 200000;
+	static const std::size_t kMemoSize = 1 << 22;
+	static const long kMaxNodes = 400000000;
+
+	const Pattern& p_;
+	std::vector<State> inputs_;
+	std::vector<State> expected_;
+	std::vector<std::pair<uint64_t,int>> memo_; // state fingerprint -> cheapest cost reaching it
+	std::vector<std::vector<State>> levels_;    // states after each instruction of the sequence tried
+	std::vector<Op> best_;
+	int best_cost_;
+	int bound_;   // cost of the sequences looked for
+	long nodes_ = 0;
+
+	bool Matches(const std::vector<State>& states) const {
+		for (int i = 0; i < kTests; ++i) {
+			if (!Same(p_, expected_[i], states[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Verify(const std::vector<Op>& code) const {
+		for (int i = 0; i < kVerifications; ++i) {
+			State input = RandomState(p_, i);
+			State expected = input, result = input;
+			Run(p_.original, expected);
+			Run(code, result);
+			if (!Same(p_, expected, result)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// skips states already reached at no greater cost
+	bool Seen(const std::vector<State>& states, int cost) {
+		uint64_t h = 0;
+		for (const State& s : states) {
+			h = h * 31 + s.Fingerprint();
+		}
+		auto& slot = memo_[h & (kMemoSize - 1)];
+		if (slot.first == h && slot.second <= cost) {
+			return true;
+		}
+		slot = std::make_pair(h, cost);
+		return false;
+	}
+
+	void Dfs(const std::vector<State>& states, std::vector<Op>& code, int cost) {
+		if (++nodes_ >= kMaxNodes) {
+			return;
+		}
+		if (!code.empty() && Matches(states) && Verify(code)) {
+			best_ = code;
+			best_cost_ = bound_ = cost;
+			return;
+		}
+		for (const Op& op : p_.alphabet) {
+			const int next_cost = cost + op.Cost();
+			if (next_cost >= bound_) {
+				continue;
+			}
+			std::vector<State>& next = levels_[code.size()];
+			next = states;
+			bool valid = true;
+			for (State& s : next) {
+				Step(op, s);
+				// stay within the free stack space, and don't pop what the caller pushed
+				valid &= !s.overflow && s.sp <= kStackTop && s.sp >= kStackTop - kStackSpace;
+			}
+			// what's pushed has to be popped (1 byte, 10 T-states for each pair)
+			const int pops = (kStackTop - next[0].sp) / 2;
+			if (!valid || next_cost + pops * (256 + 10) >= bound_ || Seen(next, next_cost)) {
+				continue;
+			}
+			code.push_back(op);
+			Dfs(next, code, next_cost);
+			code.pop_back();
+		}
+	}
+};
+
+// instruction set helpers
+void Add(std::vector<Op>& ops, Kind kind, std::initializer_list<int> xs, int y = 0, int n = 0) {
+	for (int x : xs) {
+		ops.push_back(MakeOp(kind, x, y, n));
+	}
+}
+
+void AddLoads(std::vector<Op>& ops, std::initializer_list<int> regs) {
+	for (int dst : regs) {
+		for (int src : regs) {
+			if (dst != src) {
+				ops.push_back(MakeOp(LD_R_R, dst, src));
+			}
+		}
+	}
+}
+
+void AddAlu(std::vector<Op>& ops, std::initializer_list<int> alus, std::initializer_list<int> regs) {
+	for (int alu : alus) {
+		for (int reg : regs) {
+			ops.push_back(MakeOp(ALU_R, alu, reg));
+		}
+	}
+}
+
+// the 16-bit field at offset 6 of the object HL points to (emit_fetch_int and emit_fetch_bool)
+Pattern FetchField(Pair dst, Pair scrap) {
+	const Reg dst_low = (dst == BC) ? C : E, dst_high = (dst == BC) ? B : D;
+	Pattern p;
+	p.key = std::string("ld ") + kPairNames[dst] + ",(hl+6)";
+	p.original = { MakeOp(PUSH, scrap), MakeOp(LD_RR_NN, scrap, 0, 6), MakeOp(ADD_HL, scrap),
+	               MakeOp(LD_R_IHL, dst_low), MakeOp(INC_RR, HL), MakeOp(LD_R_IHL, dst_high), MakeOp(SCF),
+	               MakeOp(SBC_HL, scrap), MakeOp(POP, scrap) };
+	p.live = { A, B, C, D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = true;
+	Add(p.alphabet, PUSH, { BC, DE, HL });
+	Add(p.alphabet, POP, { BC, DE, HL });
+	Add(p.alphabet, LD_RR_NN, { BC, DE }, 0, 6);
+	Add(p.alphabet, LD_RR_NN, { BC, DE }, 0, 0xFFF9);
+	Add(p.alphabet, ADD_HL, { BC, DE });
+	Add(p.alphabet, INC_RR, { HL });
+	Add(p.alphabet, DEC_RR, { HL });
+	Add(p.alphabet, LD_R_IHL, { dst_low, dst_high });
+	Add(p.alphabet, SBC_HL, { BC, DE });
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(ALU_R, OR, A));
+	p.alphabet.push_back(MakeOp(EX_DE_HL));
+	return p;
+}
+
+// stores a pair into the 16-bit field at offset 6 of the object HL points to (emit_store_int)
+Pattern StoreField(Pair src, Pair scrap) {
+	const Reg src_low = (src == BC) ? C : E, src_high = (src == BC) ? B : D;
+	Pattern p;
+	p.key = std::string("ld (hl+6),") + kPairNames[src];
+	p.original = { MakeOp(PUSH, scrap), MakeOp(LD_RR_NN, scrap, 0, 6), MakeOp(ADD_HL, scrap),
+	               MakeOp(LD_IHL_R, src_low), MakeOp(INC_RR, HL), MakeOp(LD_IHL_R, src_high), MakeOp(SCF),
+	               MakeOp(SBC_HL, scrap), MakeOp(POP, scrap) };
+	p.live = { A, B, C, D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = true;
+	Add(p.alphabet, PUSH, { scrap, HL });
+	Add(p.alphabet, POP, { scrap, HL });
+	Add(p.alphabet, LD_RR_NN, { scrap }, 0, 6);
+	Add(p.alphabet, LD_RR_NN, { scrap }, 0, 0xFFF9);
+	Add(p.alphabet, ADD_HL, { scrap });
+	Add(p.alphabet, INC_RR, { HL });
+	Add(p.alphabet, DEC_RR, { HL });
+	Add(p.alphabet, LD_IHL_R, { src_low, src_high });
+	Add(p.alphabet, SBC_HL, { scrap });
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(ALU_R, OR, A));
+	return p;
+}
+
+// Z set iff the Bool object HL points to is false (Cond, Loop and not; A and DE are free)
+Pattern TestField() {
+	Pattern p;
+	p.key = "z=(hl+6)==0";
+	p.original = FetchField(DE, BC).original;
+	p.original.push_back(MakeOp(ALU_R, XOR, A));
+	p.original.push_back(MakeOp(ALU_R, OR, D));
+	p.original.push_back(MakeOp(ALU_R, OR, E));
+	p.live = { B, C, H, L };
+	p.live_flags = FZ;
+	p.hl_pointer = true;
+	Add(p.alphabet, PUSH, { DE, HL });
+	Add(p.alphabet, POP, { DE, HL });
+	Add(p.alphabet, LD_RR_NN, { DE }, 0, 6);
+	Add(p.alphabet, LD_RR_NN, { DE }, 0, 0xFFF9);
+	Add(p.alphabet, ADD_HL, { DE });
+	Add(p.alphabet, INC_RR, { HL });
+	Add(p.alphabet, DEC_RR, { HL });
+	Add(p.alphabet, LD_R_IHL, { A, D, E });
+	Add(p.alphabet, ALU_IHL, { OR });
+	AddAlu(p.alphabet, { OR, XOR }, { A, D, E });
+	AddLoads(p.alphabet, { A, D, E });
+	Add(p.alphabet, SBC_HL, { DE });
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(EX_DE_HL));
+	return p;
+}
+
+// HL = HL - BC (Int subtraction; BC and A are free)
+Pattern Subtract() {
+	Pattern p;
+	p.key = "sub hl,bc";
+	p.original = { MakeOp(LD_R_R, A, C), MakeOp(CPL), MakeOp(LD_R_R, C, A), MakeOp(LD_R_R, A, B), MakeOp(CPL),
+	               MakeOp(LD_R_R, B, A), MakeOp(SCF), MakeOp(ADC_HL, BC) };
+	p.live = { D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = false;
+	AddLoads(p.alphabet, { A, B, C });
+	p.alphabet.push_back(MakeOp(CPL));
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(CCF));
+	AddAlu(p.alphabet, { OR, XOR }, { A });
+	Add(p.alphabet, ADD_HL, { BC });
+	Add(p.alphabet, ADC_HL, { BC });
+	Add(p.alphabet, SBC_HL, { BC });
+	Add(p.alphabet, INC_RR, { BC, HL });
+	Add(p.alphabet, DEC_RR, { BC, HL });
+	return p;
+}
+
+// HL = -HL (emit_neg; A is free)
+Pattern Negate() {
+	Pattern p;
+	p.key = "neg hl";
+	p.original = { MakeOp(LD_R_R, A, L), MakeOp(CPL), MakeOp(LD_R_R, L, A), MakeOp(LD_R_R, A, H), MakeOp(CPL),
+	               MakeOp(LD_R_R, H, A), MakeOp(INC_RR, HL) };
+	p.live = { B, C, D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = false;
+	AddLoads(p.alphabet, { A, H, L });
+	AddAlu(p.alphabet, { SUB, SBC, XOR, OR }, { A, H, L });
+	p.alphabet.push_back(MakeOp(CPL));
+	p.alphabet.push_back(MakeOp(NEG));
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(CCF));
+	Add(p.alphabet, INC_RR, { HL });
+	Add(p.alphabet, DEC_RR, { HL });
+	return p;
+}
+
+// HL = -DE (Int negation; A is free)
+Pattern NegateInto() {
+	Pattern p;
+	p.key = "ld hl,-de";
+	p.original = { MakeOp(LD_RR_NN, HL, 0, 0), MakeOp(ALU_R, XOR, A), MakeOp(SBC_HL, DE) };
+	p.live = { B, C, D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = false;
+	AddLoads(p.alphabet, { A, H, L });
+	Add(p.alphabet, LD_R_R, { H, L }, D);
+	Add(p.alphabet, LD_R_R, { H, L }, E);
+	Add(p.alphabet, LD_R_R, { A }, D);
+	Add(p.alphabet, LD_R_R, { A }, E);
+	AddAlu(p.alphabet, { SUB, SBC, XOR, OR }, { A, D, E });
+	p.alphabet.push_back(MakeOp(LD_RR_NN, HL, 0, 0));
+	p.alphabet.push_back(MakeOp(SBC_HL, DE));
+	p.alphabet.push_back(MakeOp(CPL));
+	p.alphabet.push_back(MakeOp(NEG));
+	p.alphabet.push_back(MakeOp(SCF));
+	Add(p.alphabet, INC_RR, { HL });
+	return p;
+}
+
+// HL = tagged Bool of a flag (tagged comparisons; A is free)
+Pattern TaggedBool(Cond cond, int tagged_true, int tagged_false) {
+	Pattern p;
+	p.key = std::string("ld hl,") + kCondNames[cond] + "?" + std::to_string(tagged_true) + ":"
+		+ std::to_string(tagged_false);
+	p.original = { MakeOp(LD_RR_NN, HL, 0, tagged_true), MakeOp(JR, cond, 0, 1),
+	               MakeOp(LD_RR_NN, HL, 0, tagged_false) };
+	p.live = { B, C, D, E, H, L };
+	p.live_flags = 0;
+	p.hl_pointer = false;
+	for (int n = 0; n <= tagged_true; ++n) {
+		p.alphabet.push_back(MakeOp(LD_RR_NN, HL, 0, n));
+		p.alphabet.push_back(MakeOp(LD_R_N, L, 0, n));
+		p.alphabet.push_back(MakeOp(LD_R_N, H, 0, n));
+		p.alphabet.push_back(MakeOp(ALU_N, ADD, 0, n));
+		p.alphabet.push_back(MakeOp(ALU_N, ADC, 0, n));
+		p.alphabet.push_back(MakeOp(ALU_N, AND, 0, n));
+	}
+	AddLoads(p.alphabet, { A, H, L });
+	AddAlu(p.alphabet, { SBC, ADC }, { A });
+	Add(p.alphabet, ROT_R, { RL, RR }, L);
+	p.alphabet.push_back(MakeOp(ADC_HL, HL));
+	p.alphabet.push_back(MakeOp(ADD_HL, HL));
+	p.alphabet.push_back(MakeOp(INC_R, L));
+	p.alphabet.push_back(MakeOp(INC_RR, HL));
+	p.alphabet.push_back(MakeOp(RLA));
+	p.alphabet.push_back(MakeOp(RLCA));
+	p.alphabet.push_back(MakeOp(CCF));
+	p.alphabet.push_back(MakeOp(PUSH, AF));
+	p.alphabet.push_back(MakeOp(POP, HL));
+	return p;
+}
+
+// flags of signed comparisons (BinaryOperator::CodeGen; A and HL are free)
+Pattern Compare(const std::string& key, const Op& carry_in, uint8_t live_flags, bool shift) {
+	Pattern p;
+	p.key = key;
+	p.original = { carry_in, MakeOp(SBC_HL, BC) };
+	if (shift) {
+		p.original.push_back(MakeOp(ADD_HL, HL));
+	}
+	p.live = { B, C, D, E };
+	p.live_flags = live_flags;
+	p.hl_pointer = false;
+	AddLoads(p.alphabet, { A, B, C, H, L });
+	AddAlu(p.alphabet, { SUB, SBC, CP, XOR, OR, AND }, { A, B, C, H, L });
+	p.alphabet.push_back(MakeOp(SCF));
+	p.alphabet.push_back(MakeOp(CCF));
+	p.alphabet.push_back(MakeOp(SBC_HL, BC));
+	p.alphabet.push_back(MakeOp(ADD_HL, HL));
+	p.alphabet.push_back(MakeOp(RLA));
+	p.alphabet.push_back(MakeOp(ROT_R, RL, H));
+	return p;
+}
+
+std::string Escape(const std::vector<Op>& code) {
+	std::string s;
+	for (const Op& op : code) {
+		for (char c : op.Text()) {
+			s += (c == '\t') ? "\\t" : std::string(1, c);
+		}
+		s += "\\n";
+	}
+	return s;
+}
+
+int Cycles(const std::vector<Op>& code) {
+	int cycles = 0;
+	for (const Op& op : code) {
+		cycles += op.Cycles(false);
+	}
+	return cycles;
+}
+
+int Bytes(const std::vector<Op>& code) {
+	int bytes = 0;
+	for (const Op& op : code) {
+		bytes += op.Bytes();
+	}
+	return bytes;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	const std::vector<Pattern> patterns = {
+		FetchField(BC, DE),
+		FetchField(DE, BC),
+		StoreField(DE, BC),
+		TestField(),
+		Subtract(),
+		Negate(),
+		NegateInto(),
+		TaggedBool(CY, 3, 2),
+		TaggedBool(Z, 3, 2),
+		Compare("c=hl<bc", MakeOp(ALU_R, XOR, A), FC, true),
+		Compare("c=hl<=bc", MakeOp(SCF), FC, true),
+		Compare("z=hl==bc", MakeOp(ALU_R, XOR, A), FZ, false),
+	};
+
+	std::cout << "/* emit_templates.cc\n"
+	          << " * generated by pax/superopt (superopt > src/emit_templates.cc); do not edit\n"
+	          << " *\n"
+	          << " * cheaper equivalents of fixed sequences of the code generator, used by pass templates\n"
+	          << " * (see emit_template)\n"
+	          << " */\n\n"
+	          << "#include \"emit.h\"\n\n"
+	          << "namespace cool {\n\n"
+	          << "const EmitTemplate emit_templates[] = {\n";
+	for (const Pattern& p : patterns) {
+		if (argc > 1 && std::find(argv + 1, argv + argc, p.key) == argv + argc) {
+			continue;
+		}
+		Search search(p);
+		const bool found = search.Find();
+		std::cerr << p.key << ": " << Bytes(p.original) << " bytes, " << Cycles(p.original) << " T-states";
+		if (found) {
+			std::cerr << " -> " << Bytes(search.best()) << " bytes, " << Cycles(search.best()) << " T-states";
+			std::cout << "\t// " << Bytes(p.original) << " -> " << Bytes(search.best()) << " bytes, "
+			          << Cycles(p.original) << " -> " << Cycles(search.best()) << " T-states\n"
+			          << "\t{ \"" << p.key << "\", \"" << Escape(search.best()) << "\" },\n";
+		} else {
+			std::cerr << ", nothing cheaper";
+		}
+		std::cerr << (search.exhausted() ? " (search cut off)" : "") << " [" << search.nodes() << " nodes]"
+		          << std::endl;
+	}
+	std::cout << "\t{ nullptr, nullptr }\n"
+	          << "};\n\n"
+	          << "} // namespace cool\n";
+	return 0;
+}
@@ -51,6 +51,8 @@ limitations under the License.
 #include <cmath>
 #include <deque>
 #include <set>
+#include <sstream>
+#include <chrono>
 #include "emit.h"
 #include "cgen.h"
 #include "cgen_routines.h"
@@ -61,7 +63,14 @@ Memmgr cgen_Memmgr = GC_NOGC;      // enable/disable garbage collection
 Memmgr_Test cgen_Memmgr_Test = GC_NORMAL;  // normal/test GC
 Memmgr_Debug cgen_Memmgr_Debug = GC_QUICK; // check heap frequently
 
-bool cgen_optimize = false;       // optimize switch for code generator
+bool cgen_report = false;         // report optimization statistics
+int cgen_inline_growth = 1024;    // max. estimated code size growth from inlining (bytes)
+bool cgen_tagged = false;         // Ints and Bools held in pointer words where they fit
+bool cgen_iy_flags = false;       // frame pointer in memory, leaving IY = flags for TI-OS
+int cgen_int_cache_low = -1;      // range of preallocated Ints returned by Int boxing (pass int-cache)
+int cgen_int_cache_high = 63;     // ... (empty if high < low)
+bool cgen_profile_generate = false; // count entries, branches and receiver classes (see CgenProfile)
+const char* cgen_profile_use = nullptr; // profile read back to guide optimization (pass profile), if any
 bool disable_reg_alloc=false;     // Don't do register allocation
 
 
@@ -82,6 +91,7 @@ namespace cool {
 
 bool gCgenDebug = false;
 int label_counter = 0;
+CgenStats gCgenStats;
 
    DispatchTables gCgenDispatchTables;
 CgenKlassTable* gCgenKlassTable;
@@ -128,6 +138,7 @@ extern Symbol
 void CgenNode::CreateAttrVarEnv(int next_offset) {
   if (parent() != nullptr) {
   	attrVarEnv_ = parent_->attrVarEnv_;
+  	attrVarEnv_.klass_ = klass();
   	objectSize_ = parent_->objectSize_;
   }
   
@@ -242,6 +253,15 @@ void CgenNode::CreateAttrVarEnv(int next_offset) {
    }
    
    
+// AssignTags: assigns tags to the subtree in preorder, returns the next unused tag
+CgenNode::ClassTag CgenNode::AssignTags(ClassTag tag) {
+  tag_ = tag++;
+  for (CgenNode* child : children_)
+    { tag = child->AssignTags(tag); }
+  max_tag_ = tag - 1;
+  return tag;
+}
+
 // CgenKlassTable initializer
 //  -builds inheritance graph
 //  -assigns class tags
@@ -250,14 +270,15 @@ void CgenNode::CreateAttrVarEnv(int next_offset) {
 CgenKlassTable::CgenKlassTable(Klasses* klasses) {
   InstallClasses(klasses);
 
-  // build inheritance graph (connect nodes) and assign tags
-  unsigned int tag = 0;
+  // build inheritance graph (connect nodes)
   for (CgenNode* isolated_node : nodes_) {
-  	isolated_node->tag_ = tag++;
     CgenNode* parent_node = ClassFind(isolated_node->parent_name());
     parent_node->children_.push_back(isolated_node);
     isolated_node->parent_ = parent_node;
   }
+
+  // assign tags in preorder, so that each class's subclasses have the tags right after its own
+  root()->AssignTags(0);
   
   // generate class variable environments, starting recursively from root (Object)
   root()->CreateAttrVarEnv(CgenLayout::Object::attribute_offset);
@@ -314,9 +335,27 @@ void CgenKlassTable::CgenConstants(std::ostream& os) const {
 
   std::size_t string_tag = TagFind(String), int_tag = TagFind(Int), bool_tag = TagFind(Bool);
   CgenDef(os, gStringTable, string_tag);
-  CgenDef(os, gIntTable, int_tag);
-  CgenDef(os, false, bool_tag);
-  CgenDef(os, true, bool_tag);
+  if (IntCache() || cgen_tagged) {
+    // those in the cache's range are defined by CgenIntCache, tagged ones aren't needed
+    std::vector<const Int16Entry*> ints;
+    for (const auto& entry : gIntTable) {
+      if (!InIntCache(entry.second->value()) && !TaggedInt(entry.second->value())) {
+        ints.push_back(entry.second.get());
+      }
+    }
+    std::sort(ints.begin(), ints.end(), [](const Int16Entry* lhs, const Int16Entry* rhs) {
+      return lhs->id() > rhs->id();
+    });
+    for (const Int16Entry* entry : ints) {
+      CgenDef(os, entry, int_tag);
+    }
+  } else {
+    CgenDef(os, gIntTable, int_tag);
+  }
+  if (!cgen_tagged) {
+    CgenDef(os, false, bool_tag);
+    CgenDef(os, true, bool_tag);
+  }
 }
 
 
@@ -353,11 +392,13 @@ void CgenKlassTable::CgenGlobalText(std::ostream& os) const {
             return lhs.second.loc_ < rhs.second.loc_; // compare absolute addresses
          });
       
-      /* generate dispatch table for class */
-      os << klass()->name() << DISPTAB_SUFFIX << LABEL;
-      for (auto method_pair : ordered_table) {
-         DispatchEntry& dispent = method_pair.second;
-         os << dispent;
+      /* generate dispatch table for class (only referenced by its prototype object) */
+      if (instantiated_) {
+         os << klass()->name() << DISPTAB_SUFFIX << LABEL;
+         for (auto method_pair : ordered_table) {
+            DispatchEntry& dispent = method_pair.second;
+            os << dispent;
+         }
       }
       
       for (CgenNode* child : children_)
@@ -366,37 +407,76 @@ void CgenKlassTable::CgenGlobalText(std::ostream& os) const {
    
 // CgenDispatchTables: emits all dispatch tables
 void CgenKlassTable::CgenDispatchTables(std::ostream& os) const {
+  if (compact_) {
+    CgenCompactDispatchTables(os);
+    return;
+  }
   root()->EmitDispatchTable(os);
 }
 
 // modified 8/18
 void CgenNode::EmitPrototypeObject(std::ostream& os) {
+  if (!instantiated_) {
+    for (CgenNode* child : children_)
+      { child->EmitPrototypeObject(os); }
+    return;
+  }
+
   // handle Int, String, Bool separately
   os << DW << "-1" << std::endl;	// GC tag
   os << klass()->name() << PROTOBJ_SUFFIX << LABEL; // protobj label
   os << DW << tag_ << std::endl; // class tag
   if (klass()->name() == String) {
-    os << DW << 7 << std::endl; // size of object (bytes)
+    os << DW << ObjectSize() << std::endl; // size of object (bytes)
     os << DW << klass()->name() << DISPTAB_SUFFIX << std::endl;
     os << DW;
     CgenRef(os, gIntTable.lookup(0)) << std::endl;
     os << DW << 0 << std::endl;
   } else if (klass()->name() == Int || klass()->name() == Bool) {
     // attributes end up being the same for Int & Bool
-    os << DW << 8 << std::endl; // 8 bytes
+    os << DW << ObjectSize() << std::endl;
     os << DW << klass()->name() << DISPTAB_SUFFIX << std::endl;
     os << DW << 0 << std::endl;
   } else {
-    os << DW << objectSize_ << std::endl;
+    os << DW << ObjectSize() << std::endl;
     os << DW << klass()->name() << DISPTAB_SUFFIX << std::endl;
-    for (int i = 0; i < attrVarEnv_.vars_.size(); ++i)
-    	{ os << DW << 0 << std::endl; }
+    // initial values: literals the initializer needn't store, or else the type's default
+    for (const AttrInit& init : AttrInits()) {
+      Expression* value = init.in_prototype ? init.attr->init() : nullptr;
+      Symbol* type = init.attr->decl_type();
+      os << DW;
+      if (IntLiteral* lit = dynamic_cast<IntLiteral*>(value)) {
+        CgenRef(os, gIntTable.lookup(lit->value()));
+      } else if (BoolLiteral* lit = dynamic_cast<BoolLiteral*>(value)) {
+        CgenRef(os, lit->value());
+      } else if (StringLiteral* lit = dynamic_cast<StringLiteral*>(value)) {
+        CgenRef(os, gStringTable.lookup(lit->value()));
+      } else if (type == Int) {
+        CgenRef(os, gIntTable.lookup(0));
+      } else if (type == Bool) {
+        CgenRef(os, false);
+      } else if (type == String) {
+        CgenRef(os, gStringTable.lookup(std::string("")));
+      } else {
+        os << 0;
+      }
+      os << std::endl;
+    }
   }
   
   for (CgenNode* child : children_)
     { child->EmitPrototypeObject(os); }
 }
 
+int CgenNode::ObjectSize() const {
+  if (klass()->name() == String) {
+    return 7;
+  } else if (klass()->name() == Int || klass()->name() == Bool) {
+    return 8;
+  }
+  return objectSize_;
+}
+
 // CgenPrototypeObjects: emit prototype objects for all classes
 void CgenKlassTable::CgenPrototypeObjects(std::ostream& os) const {
   root()->EmitPrototypeObject(os);
@@ -417,7 +497,7 @@ void CgenKlassTable::CgenClassNameTab(std::ostream& os) const {
     gStringTable.emplace(p.second->value());
     Symbol* class_name = gStringTable.lookup(p.second->value());
     CgenDef(os, class_name, TagFind(String));
-    if (!had_length_entry) {
+    if (!had_length_entry && !InIntCache(class_name->value().size()) && !TaggedInt(class_name->value().size())) {
       // int constant for str len needs to be generated
       Int16Entry* length_entry = gIntTable.lookup(class_name->value().size());
       CgenDef(os, length_entry, TagFind(Int));
@@ -435,91 +515,163 @@ void CgenKlassTable::CgenClassNameTab(std::ostream& os) const {
 
 // CgenClassObjTab: emit class object table
 void CgenKlassTable::CgenClassObjTab(std::ostream& os) const {
-  std::map<int,Symbol*> ordered_class_names;
+  std::map<int,const CgenNode*> ordered_classes;
   for (CgenNode* node : nodes_) {
-    ordered_class_names[node->tag_] = node->klass()->name();
+    ordered_classes[node->tag_] = node;
   }
   
   os << CLASSOBJTAB << LABEL;
-  for (std::pair<int,Symbol*> p : ordered_class_names) {
-    os << DW << p.second << PROTOBJ_SUFFIX << std::endl;
-    os << DW << p.second << CLASSINIT_SUFFIX << std::endl;
+  for (std::pair<int,const CgenNode*> p : ordered_classes) {
+    if (p.second->instantiated_) {
+      os << DW << p.second->klass()->name() << PROTOBJ_SUFFIX << std::endl;
+      os << DW << p.second->klass()->name() << CLASSINIT_SUFFIX << std::endl;
+    } else {
+      // only used by new SELF_TYPE, so never read for classes without objects
+      os << DW << 0 << std::endl;
+      os << DW << 0 << std::endl;
+    }
+  }
+}
+
+
+std::vector<CgenNode::AttrInit> CgenNode::AttrInits() {
+  std::vector<AttrInit> inits;
+  if (parent() != nullptr) {
+    inits = parent()->AttrInits();
   }
+  // a literal can only be in the prototype if no initializer before it could read the attribute
+  bool constant = std::all_of(inits.begin(), inits.end(), [](const AttrInit& init) { return init.in_prototype; });
+  for (Features::const_iterator feature = klass()->features_begin(); feature != klass()->features_end(); ++feature) {
+    if ((*feature)->attr()) {
+      Attr* attr = (Attr*) *feature;
+      Expression* init = attr->init();
+      const bool literal = dynamic_cast<IntLiteral*>(init) != nullptr || dynamic_cast<BoolLiteral*>(init) != nullptr
+        || dynamic_cast<StringLiteral*>(init) != nullptr;
+      const bool in_prototype = dynamic_cast<NoExpr*>(init) != nullptr || (literal && constant);
+      constant = constant && in_prototype;
+      inits.push_back({this, attr, in_prototype});
+    }
+  }
+  return inits;
 }
 
+bool CgenNode::EmptyInitializer() {
+  const std::vector<AttrInit> inits = AttrInits();
+  return std::all_of(inits.begin(), inits.end(), [](const AttrInit& init) { return init.in_prototype; });
+}
 
-// EmitInitializer: emit initializer for class
+static int CountNodes(Expression* expr) {
+  int count = 1;
+  expr->ForEachChild([&](Expression* child) { count += CountNodes(child); });
+  return count;
+}
+
+// number of instantiated classes in this class's subtree
+int CgenNode::InstantiatedBelow() const {
+  int count = instantiated_;
+  for (const CgenNode* child : children_) {
+    count += child->InstantiatedBelow();
+  }
+  return count;
+}
+
+bool CgenNode::SharedAttrInit() {
+  const int kInlineInitNodes = 4; // largest stores (in AST nodes) copied into every initializer
+  int nodes = 0;
+  for (const AttrInit& init : AttrInits()) {
+    if (init.owner == this && !init.in_prototype) {
+      nodes += CountNodes(init.attr->init());
+    }
+  }
+  return nodes > kInlineInitNodes && InstantiatedBelow() > 1;
+}
+
+// store an attribute's initial value, in the environment of the class declaring it;
+// expects self to be bound and the frame to have room for the initializer's temporaries
+void CgenNode::EmitAttrStore(const AttrInit& init, std::ostream& os) {
+  VariableEnvironment& varEnv = init.owner->attrVarEnv_;
+  varEnv.init_type_ = init.attr->decl_type();
+  init.attr->init()->CodeGen(varEnv, os);	// result in ACC
+  emit_load(MemoryValue(varEnv.Lookup(init.attr->name())), ARG0, os);
+  varEnv.init_type_ = nullptr;
+}
+
+// EmitInitializer: emit initializer for class, a single routine with the ancestors' attribute
+// stores copied in or, if they are large, called as subroutines without frames of their own
 void CgenNode::EmitInitializer(std::ostream& os) {
-  attrVarEnv_.klass_ = klass(); // set current class
-  attrVarEnv_.ResetTemporaryCount(); // so temporaries will be assigned to proper loc
-  os << klass()->name() << CLASSINIT_SUFFIX << LABEL;
+  std::vector<AttrInit> stores;
+  for (const AttrInit& init : AttrInits()) {
+    if (!init.in_prototype) {
+      stores.push_back(init);
+    }
+  }
 
-  if (klass()->name() == Object) {
-  	// do nothing
-  } else {
-    Symbol* parent_name = parent()->klass()->name();
-    
-    // set up activation record
-    emit_push(FP, os);
-  	emit_push(SELF, os);
-  	emit_load(RegisterValue(FP), Immediate16((int16_t) 0), os);
-  	emit_add(FP, RegisterValue(SP), os);	// FP = new frame pointer value
+  // find maximum number of temporaries needed over all attributes; the slots are
+  // allocated before any store is emitted, including those shared through _attrInit,
+  // whose temporaries are then counted in the frame of every initializer calling it
+  int max_temps = 0;
+  int nested_slots = 0;
+  for (const AttrInit& init : stores) {
+    FrameSlots slots;
+    init.attr->init()->AllocSlots(slots);
+    max_temps = std::max(max_temps, slots.Color());
+    nested_slots += slots.nested();
+  }
 
-  	// emit_load(SELF, ARG0, os); // bind self
-    os << EX << rDE << "," << rHL << std::endl;
-  emit_load(SELF, rDE, os); // bind self, but can only do it with DE -> IX
-    
-    
-    // find maximum number of temporaries needed over all attributes
-    int max_temps = 0;
-    for (Features::const_iterator feature = klass()->features_begin(); feature != klass()->features_end(); ++feature) {
-      if ((*feature)->attr()) {
-        Attr* attr = (Attr*) (*feature);
-        max_temps = std::max(max_temps, attr->init()->CalcTemps());
+  if (initialized_ && SharedAttrInit()) {
+    os << klass()->name() << ATTRINIT_SUFFIX << LABEL;
+    for (const AttrInit& init : stores) {
+      if (init.owner == this) {
+        EmitAttrStore(init, os);
       }
     }
-    assert (max_temps*WORD_SIZE == (int8_t) (max_temps*WORD_SIZE));	// if this fails, then codegen will fail -- need workaround
-    // max_temps ≤ 63 because IY register can be offset using a signed 8-bit int, which allows for a range of -128≤x≤127 bytes
-    emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(-max_temps*WORD_SIZE)), os);
-    emit_add(rHL, RegisterValue(SP), os);
-	emit_load(RegisterValue(SP), RegisterValue(rHL), os);
-	// don't change IY, though
-	
-    // call parent initializer
-//     emit_load(ARG0, SELF, os);
-  	emit_load(rDE, SELF, os); // bind self, but can only do it with DE -> IX    
-	os << EX << rDE << "," << rHL << std::endl;
+    emit_return(Flags::none, os);
+  }
 
-    AbsoluteAddress addr(get_init_ref(parent_name));
-    emit_call(addr, Flags::none, os);
-	
-	// set self for attribute initializers
-// 	emit_load(SELF, ARG0, os); // dont need to do this, actually
-	
-	// initialize attributes
-	for (Features::const_iterator feature = klass()->features_begin(); feature != klass()->features_end(); ++feature) {
-	  if ((*feature)->attr()) {
-	    Attr* attr = (Attr*) (*feature);
-	    Expression* init = attr->init();
-	    attrVarEnv_.init_type_ = attr->decl_type();    
-	    init->CodeGen(attrVarEnv_, os);	// result in ACC
-	    MemoryLocation& attr_offset = attrVarEnv_.Lookup(attr->name());   
-		MemoryValue attr_val(attr_offset);
-		emit_load(attr_val, ARG0, os);
-	  }
-	}
-	
-	// cleanup
-	emit_load(rDE, SELF, os); 
-	os << EX << rDE << "," << rHL << std::endl; // current object expected in ACC
-	emit_load(SP, FP, os);
-	emit_pop(SELF, os);
-	emit_pop(FP, os);
-		
-	attrVarEnv_.init_type_ = nullptr;
+  if (instantiated_) {
+    os << klass()->name() << CLASSINIT_SUFFIX << LABEL;
+
+    if (!stores.empty()) {
+      gCgenStats.nested_slots += nested_slots;
+      gCgenStats.frame_slots += max_temps;
+
+      // set up activation record (as for methods; temporaries are above FP)
+      if (max_temps > 0) {
+        emit_push_frame(os);
+      }
+      emit_push(SELF, os);
+      if (max_temps > 0) {
+        emit_set_frame(max_temps, os); // FP = SP = end of temporaries
+      }
+      os << EX << rDE << "," << rHL << std::endl;
+      emit_load(SELF, rDE, os); // bind self, but can only do it with DE -> IX
+
+      // initialize attributes, ancestors' first
+      for (std::size_t i = 0; i < stores.size(); ++i) {
+        CgenNode* owner = stores[i].owner;
+        if (!owner->SharedAttrInit()) {
+          EmitAttrStore(stores[i], os);
+        } else if (i == 0 || stores[i - 1].owner != owner) {
+          emit_call(AbsoluteAddress(std::string(owner->klass()->name()->value()) + ATTRINIT_SUFFIX), Flags::none, os);
+        }
+      }
+
+      // cleanup
+      if (max_temps > 0) {
+        emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(max_temps*WORD_SIZE)), os);
+        emit_add(rHL, RegisterValue(SP), os);
+        emit_load(RegisterValue(SP), RegisterValue(rHL), os);
+      }
+      emit_load(rDE, SELF, os);
+      os << EX << rDE << "," << rHL << std::endl; // current object expected in ACC
+      emit_pop(SELF, os);
+      if (max_temps > 0) {
+        emit_pop_frame(os);
+      }
+    }
+    emit_return(Flags::none, os);
   }
-  emit_return(Flags::none, os); // return for both Object & other types
-  
+
   for (CgenNode* child : children_) {
     child->EmitInitializer(os);
   }
@@ -534,11 +686,8 @@ void CgenKlassTable::CgenClassInits(std::ostream& os) const {
 void CgenNode::EmitMethods(std::ostream& os) {
   if (!basic()) {
     for (Features::const_iterator feat_it = klass()->features_begin(); feat_it != klass()->features_end(); ++feat_it) {
-      if ((*feat_it)->method()) {
-        Method* method = (Method*) (*feat_it);
-        os << klass()->name() << METHOD_SEP << method->name() << LABEL;
-        attrVarEnv_.klass_ = klass();
-        method->CodeGen(attrVarEnv_, os);
+      if ((*feat_it)->method() && Reachable(((Method*) *feat_it)->name())) {
+        EmitMethod((Method*) *feat_it, os);
       }
     }
   }
@@ -548,12 +697,25 @@ void CgenNode::EmitMethods(std::ostream& os) {
   }
 }
 
+void CgenNode::EmitMethod(Method* method, std::ostream& os) {
+  os << klass()->name() << METHOD_SEP << method->name() << LABEL;
+  attrVarEnv_.klass_ = klass();
+  method->CodeGen(attrVarEnv_, os);
+}
 
-void CgenNode::EmitInheritanceInfo(std::ostream& os) const {
-	os << DW << tag_ << std::endl;
-	os << DW << (parent_->tag_ - tag_) * CgenLayout::InheritanceTree::entry_length - 1 << std::endl;
+// EmitDeadMethods: labels for unreachable methods, which still appear in dispatch tables
+void CgenNode::EmitDeadMethods(std::ostream& os) const {
+  for (Features::const_iterator feat_it = klass()->features_begin(); feat_it != klass()->features_end(); ++feat_it) {
+    if ((*feat_it)->method() && !Reachable(((Method*) *feat_it)->name())) {
+      os << klass()->name() << METHOD_SEP << ((Method*) *feat_it)->name() << LABEL;
+    }
+  }
+  for (CgenNode* child : children_) {
+    child->EmitDeadMethods(os);
+  }
 }
 
+
 int CgenKlassTable::InheritanceDepth(const CgenNode *node) const {
 	int depth;
 	for (depth = 0; node && node != root(); ++depth, node = node->parent()) {}
@@ -587,36 +749,260 @@ std::pair<bool,int> CgenKlassTable::InheritanceDistance(const CgenNode* child, c
 	return std::pair<bool,int>(false, 0);
 }
 
-std::map<std::size_t, const CgenNode *> CgenKlassTable::GetTags() const {
-	std::map<std::size_t, const CgenNode *> tags;
-	std::deque<const CgenNode *> todo;
-	todo.push_front(root());
-	
-	while (!todo.empty()) {
-		const CgenNode *node = todo.back();
-		todo.pop_back();
-		tags[node->tag()] = node;
-		std::vector<CgenNode*> children = node->children_;
-		for (CgenNode *child : children)
-			todo.push_front(child);
+bool CgenNode::OverriddenBelow(Symbol* method, const Symbol* impl) const {
+	for (CgenNode* child : children_) {
+		auto entry = child->dispTab_.find(method);
+		if (entry->second.klass_ != impl || child->OverriddenBelow(method, impl))
+			return true;
 	}
-	
-	return tags;
+	return false;
+}
+
+const Symbol* CgenKlassTable::DispatchTarget(Symbol* klass, Symbol* method) const {
+	const CgenNode* node = ClassFind(klass);
+	const Symbol* impl = node->dispTab_.find(method)->second.klass_;
+	return node->OverriddenBelow(method, impl) ? nullptr : impl;
+}
+
+void CgenStats::Report(std::ostream& os) const {
+	os << "folded expressions:        " << folded << std::endl;
+	os << "strength-reduced mul/div:  " << reduced << std::endl;
+	os << "loop-invariant hoists:     " << hoisted << std::endl;
+	os << "value numbering:           " << numbered << " shared, " << loads_removed << " loads removed" << std::endl;
+	for (const auto& method : numbered_methods) {
+		os << "  " << method.first << ": " << method.second.first << " shared, " << method.second.second
+		   << " loads removed" << std::endl;
+	}
+	os << "dead values & stores:      " << dead_values << " values, " << dead_stores << " stores" << std::endl;
+	os << "cached Int boxing:         " << boxed << " sites (" << cgen_int_cache_low << ".." << cgen_int_cache_high
+	   << ")" << std::endl;
+	os << "devirtualized dispatches:  " << devirtualized << "/" << dispatches << std::endl;
+	os << "inlined call sites:        " << inlined << " (~" << inline_growth << " bytes)" << std::endl;
+	os << "unreachable methods:       " << dead_methods << std::endl;
+	os << "unreachable initializers:  " << dead_inits << std::endl;
+	os << "uninstantiated classes:    " << dead_classes << " (" << dead_data << " bytes of data)" << std::endl;
+	os << "tail calls:                " << tail_calls << " (" << tail_recursions << " self-recursive)" << std::endl;
+	os << "dispatch tables:           " << disptab_bytes << " -> " << compact_bytes << " bytes" << std::endl;
+	os << "frame slots:               " << nested_slots << " -> " << frame_slots << std::endl;
+	os << "leaf prologues:            " << frameless << " without frame, " << unbound_self << " without self" << std::endl;
+	os << "relaxed branches:          " << shortened_branches << " jp -> jr, " << lengthened_branches << " jr -> jp"
+	   << std::endl;
+	os << "profile counters:          " << profile_counters << std::endl;
+	os << "profile-guided layout:     " << guarded << " guarded dispatches, " << hot_arms << " then arms, "
+	   << rotated_loops << " rotated loops" << std::endl;
+	os << "register arguments:        " << register_args << " (" << unpushed_args << " never pushed)" << std::endl;
+	os << "builtin calls lowered:     " << intrinsics << " (" << unboxed_lengths << " unboxed lengths)" << std::endl;
+	os << "branches on flags:         " << flag_branches << std::endl;
+}
+
+void CgenKlassTable::EmitCopy(Symbol* klass, std::ostream& os) {
+  const int kMaxUnrolledCopy = 32; // largest object copied by a specialized routine (bytes)
+  const int size = ClassFind(klass)->ObjectSize();
+  if (CgenPassEnabled(PASS_COPY) && size <= kMaxUnrolledCopy) {
+    copy_sizes_.insert(size);
+    emit_copy(size, os);
+    ++gCgenStats.copies;
+  } else {
+    emit_copy(os);
+  }
+}
+
+// CgenCopyRoutines: emit the copy routines used by EmitCopy: like Object.copy, but with the
+// size known, a bump allocation by _alloc and an unrolled copy (16 instead of 21 T-states per
+// byte); the copies share one ldi sequence, entered at the right distance from its end
+void CgenKlassTable::CgenCopyRoutines(std::ostream& os) const {
+  if (copy_sizes_.empty()) {
+    return;
+  }
+  for (int size : copy_sizes_) {
+    os << COPY_PREFIX << size << LABEL;
+    emit_load(RegisterValue(rBC), Immediate16(static_cast<int16_t>(size)), os);
+    emit_call(AbsoluteAddress("_alloc"), Flags::none, os); // DE = new object
+    emit_push(rDE, os);
+    emit_jp(AbsoluteAddress(std::string(COPY_PREFIX) + "ldi" + std::to_string(size)), Flags::none, os);
+  }
+  for (int i = *copy_sizes_.rbegin(); i > 0; --i) {
+    if (copy_sizes_.count(i)) {
+      os << COPY_PREFIX << "ldi" << i << LABEL;
+    }
+    os << LDI << std::endl;
+  }
+  emit_pop(ARG0, os);
+  emit_return(Flags::none, os);
+}
+
+bool CgenKlassTable::LateBoxing() const {
+  return cgen_tagged || IntCache();
+}
+
+bool CgenKlassTable::IntCache() const {
+  return CgenPassEnabled(PASS_INT_CACHE) && !cgen_tagged && cgen_int_cache_low <= cgen_int_cache_high;
+}
+
+bool CgenKlassTable::InIntCache(int value) const {
+  return IntCache() && value >= cgen_int_cache_low && value <= cgen_int_cache_high;
+}
+
+void CgenKlassTable::EmitBoxInt(std::ostream& os) {
+  if (cgen_tagged) {
+    emit_call(AbsoluteAddress("_int_box"), Flags::none, os);
+    return;
+  }
+  int_cache_used_ = true;
+  ++gCgenStats.boxed;
+  emit_call(AbsoluteAddress(BOXINT), Flags::none, os);
+}
+
+void CgenKlassTable::EmitUnboxInt(std::ostream& os) const {
+  assert (cgen_tagged);
+  emit_call(AbsoluteAddress("_int_unbox"), Flags::none, os);
+}
+
+// CgenIntCache: emit the routine used by EmitBoxInt and the table of preallocated Ints it
+// returns, which also holds the Int constants in its range (see InIntCache); Ints are never modified once
+// boxed, so sharing them is safe, and equality_test compares their values, not addresses
+void CgenKlassTable::CgenIntCache(std::ostream& os) {
+  if (!IntCache()) {
+    return;
+  }
+  std::map<int16_t,const Int16Entry*> consts;
+  for (const auto& entry : gIntTable) {
+    if (InIntCache(entry.second->value())) {
+      consts[entry.second->value()] = entry.second.get();
+    }
+  }
+  const std::size_t int_tag = TagFind(Int);
+  if (!int_cache_used_) {
+    for (const auto& value : consts) {
+      CgenDef(os, value.second, int_tag);
+    }
+    return;
+  }
+
+  // HL = DE - low: in range iff below the table's length, unsigned
+  const int l_new = label_counter++;
+  const int length = cgen_int_cache_high - cgen_int_cache_low + 1;
+  os << BOXINT << LABEL;
+  emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(-cgen_int_cache_low)), os);
+  emit_add(rHL, rDE, os);
+  emit_load(RegisterValue(rBC), Immediate16(static_cast<int16_t>(length)), os);
+  os << OR << rA << std::endl;
+  os << SBC << rHL << "," << rBC << std::endl;
+  emit_jr(l_new, Flags::NC, os);
+  emit_add(rHL, rBC, os);
+  for (int shift = 0; (1 << shift) < (DEFAULT_OBJFIELDS + INT_SLOTS) * WORD_SIZE; ++shift) {
+    emit_add(rHL, rHL, os);
+  }
+  emit_load(RegisterValue(rBC), LabelValue(INTCACHE), os);
+  emit_add(rHL, rBC, os);
+  emit_return(Flags::none, os);
+  emit_label_def(l_new, os);
+  emit_push(rDE, os);
+  emit_load(RegisterValue(ARG0), LabelValue(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX)), os);
+  EmitCopy(Int, os);
+  emit_pop(rDE, os);
+  emit_store_int(rDE, RegisterPointer(ARG0), os);
+  emit_return(Flags::none, os);
+
+  os << INTCACHE << LABEL;
+  for (int value = cgen_int_cache_low; value <= cgen_int_cache_high; ++value) {
+    if (consts.count(value)) {
+      CgenRef(os, consts[value]) << LABEL;
+    }
+    os << DW << int_tag << std::endl
+       << DW << (DEFAULT_OBJFIELDS + INT_SLOTS) * WORD_SIZE << std::endl
+       << DW; emit_disptable_ref(Int, os); os << std::endl;
+    os << DW << value << std::endl;
+  }
 }
 
 // CgenClassMethods: emit methods for all classes
 void CgenKlassTable::CgenClassMethods(std::ostream& os) const {
-  root()->EmitMethods(os);
+  if (CgenPassEnabled(PASS_PROFILE) && gCgenProfile.loaded()) {
+    // with a profile, the methods entered most often come first, together, and those never entered last
+    std::vector<std::pair<CgenNode*,Method*>> methods;
+    std::function<void(CgenNode*)> collect = [&](CgenNode* node) {
+      if (!node->basic()) {
+        for (auto feat_it = node->klass()->features_begin(); feat_it != node->klass()->features_end(); ++feat_it) {
+          if ((*feat_it)->method() && node->Reachable(((Method*) *feat_it)->name())) {
+            methods.push_back(std::make_pair(node, (Method*) *feat_it));
+          }
+        }
+      }
+      for (CgenNode* child : node->children_) {
+        collect(child);
+      }
+    };
+    collect(root());
+    std::stable_sort(methods.begin(), methods.end(),
+                     [](const std::pair<CgenNode*,Method*>& a, const std::pair<CgenNode*,Method*>& b) {
+                       return gCgenProfile.Count(a.second, 0) > gCgenProfile.Count(b.second, 0);
+                     });
+    for (const auto& method : methods) {
+      method.first->EmitMethod(method.second, os);
+    }
+  } else {
+    root()->EmitMethods(os);
+  }
+
+  std::ostringstream dead;
+  root()->EmitDeadMethods(dead);
+  if (!dead.str().empty()) {
+    os << dead.str();
+    const AbsoluteAddress abort_wait("_abort_wait");
+    emit_jp(abort_wait, Flags::none, os); // never reached
+  }
 }
 
-void CgenKlassTable::CgenInheritanceTree(std::ostream& os) const {
-	os << INHERITANCE_TREE << LABEL;
+// FindEqualities: whether expr compares Strings (String.equal_) or two Objects (equality_test, which
+// may compare Strings too; see BinaryOperator::CodeGenFlags)
+static void FindEqualities(Expression* expr, bool& strings, bool& objects) {
+  expr->ForEachChild([&](Expression* child) { FindEqualities(child, strings, objects); });
+  BinaryOperator* op = dynamic_cast<BinaryOperator*>(expr);
+  if (op != nullptr && op->kind() == BinaryOperator::BO_EQ) {
+    strings = strings || op->lhs()->type() == String;
+    objects = objects || (op->lhs()->type() == Object && op->rhs()->type() == Object);
+  }
+}
 
-	std::map<std::size_t, const CgenNode *> tags = GetTags();
-	for (std::pair<std::size_t, const CgenNode *> tag : tags) {
-		tag.second->EmitInheritanceInfo(os);
-	}
-		
+// CgenRuntimeOmissions: leave basic methods that are never called out of the runtime library
+void CgenKlassTable::CgenRuntimeOmissions(std::ostream& os) const {
+  for (Symbol* klass : {Object, IO, String}) {
+    const CgenNode* node = ClassFind(klass);
+    for (Features::const_iterator feat_it = node->klass()->features_begin(); feat_it != node->klass()->features_end(); ++feat_it) {
+      if ((*feat_it)->method() && !node->Reachable(((Method*) *feat_it)->name())) {
+        Symbol* method = ((Method*) *feat_it)->name();
+        os << DEFINE << "_omit." << klass << METHOD_SEP << method << std::endl;
+      }
+    }
+  }
+  // objects are only copied by size-specialized routines with pass copy (see EmitCopy)
+  if (!CgenPassEnabled(PASS_COPY)) {
+    os << DEFINE << "_omit._alloc" << std::endl;
+  }
+  // equality routines are only called by = on Strings or on two Objects
+  bool strings = false;
+  bool objects = false;
+  for (const CgenNode* node : nodes_) {
+    for (Features::const_iterator feat_it = node->klass()->features_begin(); feat_it != node->klass()->features_end(); ++feat_it) {
+      if ((*feat_it)->method()) {
+        FindEqualities(((Method*) *feat_it)->body(), strings, objects);
+      } else {
+        FindEqualities(((Attr*) *feat_it)->init(), strings, objects);
+      }
+    }
+  }
+  if (!objects) {
+    os << DEFINE << "_omit.equality_test" << std::endl;
+  }
+  if (!strings && !objects) {
+    os << DEFINE << "_omit.String.equal_" << std::endl;
+  }
+  // keyboard input is only read by IO.in_string & IO.in_int
+  const CgenNode* io = ClassFind(IO);
+  if (!io->Reachable(in_string) && !io->Reachable(in_int)) {
+    os << DEFINE << "_omit.keyboard" << std::endl;
+  }
 }
 
 void CgenHeader(std::ostream& os) {
@@ -640,7 +1026,9 @@ void CgenHeader(std::ostream& os) {
 		"Object.z80",
 		"IO.z80",
 		"math.z80",
-		"String.z80"
+		"String.z80",
+		"tagged.z80",
+		"profile.z80"
 	};
 
    std::string aux_files[] = {
@@ -668,6 +1056,16 @@ void CgenHeader(std::ostream& os) {
 }
 
    void CgenKlassTable::CodeGen(std::ostream& os, const char *asm_path, const char *lib_path) {
+      if (cgen_tagged) {
+         os << DEFINE << "_tagged" << std::endl; // runtime support for tagged Ints & Bools
+      }
+      if (cgen_iy_flags) {
+         os << DEFINE << "_iy_flags" << std::endl; // runtime may call TI-OS without setting IY
+      }
+      if (cgen_profile_generate) {
+         gCgenProfile.EmitDefines(os);
+      }
+      CgenRuntimeOmissions(os);
       CgenHeader(os);
       
       CgenGlobalData(os);
@@ -678,13 +1076,17 @@ void CgenHeader(std::ostream& os) {
       
       CgenClassObjTab(os);
       CgenClassNameTab(os);
-      CgenInheritanceTree(os);
       
       CgenGlobalText(os);
       
       
-      CgenClassInits(os);
-      CgenClassMethods(os);
+      // code is buffered so that its branches can be relaxed once its size is known
+      std::ostringstream code;
+      CgenClassInits(code);
+      CgenClassMethods(code);
+      CgenIntCache(code);
+      CgenCopyRoutines(code);
+      os << CgenRelaxBranches(code.str(), CgenPassEnabled(PASS_RELAX));
 
       /* generate dispatch tables to separate file */
       std::filebuf disptab_fb;
@@ -697,7 +1099,12 @@ void CgenHeader(std::ostream& os) {
       disptab_os.flush();
       disptab_fb.close();
       
+      os.flush(); // the assembler reads the output file
       CgenSymbolTable(asm_path, lib_path);
+
+      if (cgen_report) {
+         gCgenStats.Report(std::clog);
+      }
    }
    
    
@@ -706,47 +1113,113 @@ void CgenHeader(std::ostream& os) {
 void Method::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   // need to add formals to variable environment
   // don't need to worry about binding self in codegen
-  varEnv.ResetTemporaryCount();
-  int temp_count = body_->CalcTemps();
+  FrameSlots slots;
+  body_->AllocSlots(slots);
+  int temp_count = slots.Color();
+  gCgenStats.frame_slots += temp_count;
+  gCgenStats.nested_slots += slots.nested();
+
+  // leaf methods skip the parts of the AR they don't use (see CgenFrameUse)
+  const FrameUse use = CgenPassEnabled(PASS_FRAME) ? CgenFrameUse(this, varEnv) : FrameUse();
+  const bool frame = (temp_count > 0 || use.formals);
+  gCgenStats.frameless += !frame;
+  gCgenStats.unbound_self += !use.self;
+  gCgenProfile.EmitCount(this, 0, os);
+  const CallConvention call = CgenCallConvention(name_, formals()->size());
+  const int pushed = use.formals ? call.registers : 0;
   
   // perform callee AR setup
-  emit_push(FP, os);
-  emit_push(SELF, os);
-  // note: FP is below (on top of) all temporaries on the stack, since IY can only be indexed with positive offsets
-  emit_load(RegisterValue(FP), Immediate16(static_cast<int16_t>(-temp_count*WORD_SIZE)), os);
-  emit_add(FP, SP, os);	// FP = new frame pointer value
-  emit_load(SP, FP, os); // update stack pointer to end of temporaries
+  if (frame) {
+    // register arguments the body reads go where the caller would have pushed them
+    if (pushed > 0) {
+      emit_push(rDE, os);
+    }
+    if (pushed > 1) {
+      emit_push(rBC, os);
+    }
+    emit_push_frame(os);
+  }
+  if (use.self) {
+    emit_push(SELF, os);
+  }
+  if (frame) {
+    // note: FP is below (on top of) all temporaries on the stack, since IY can only be indexed with positive offsets
+    emit_set_frame(temp_count, os);
+  }
   
-  os << EX << rDE << "," << rHL << std::endl;
-  emit_load(RegisterValue(SELF), RegisterValue(rDE), os); // bind self, but can only do it with DE -> IX
+  if (use.self) {
+    os << EX << rDE << "," << rHL << std::endl;
+    emit_load(RegisterValue(SELF), RegisterValue(rDE), os); // bind self, but can only do it with DE -> IX
+  }
 
+  // without a frame, tail calls can't overwrite the arguments, so only those without any are made
+  varEnv.method_ = (frame || formals()->size() == 0) ? this : nullptr;
+  varEnv.method_temps_ = temp_count;
+  varEnv.method_args_ = temp_count*WORD_SIZE + CgenLayout::ActivationRecord::arguments_end - (use.self ? 0 : WORD_SIZE)
+    + pushed*WORD_SIZE;
+  varEnv.method_frame_ = frame;
+  varEnv.method_self_ = use.self;
+  varEnv.method_pushed_ = pushed;
+  varEnv.method_call_ = call;
+  varEnv.method_entry_ = label_counter++;
+  emit_label_def(varEnv.method_entry_, os); // self-recursive tail calls jump here
+
+  // [saved FP][BC][DE][return address][stack arguments, last first]
+  varEnv.method_formals_.clear();
   int formals_counter = formals()->size();
   for (Formals::const_iterator formals_it = formals_begin(); formals_it != formals_end(); ++formals_it) {
     Formal* formal = *formals_it;
     --formals_counter; // subtract first, since formals_counter starts out at 1 past last arg
     // need to assign location relative to FP
 //     MemoryLocation* formal_loc = new IndirectLocation(formals_counter, FP);
-	RegisterPointerOffset formal_loc(FP, (temp_count+formals_counter)*WORD_SIZE + CgenLayout::ActivationRecord::arguments_end);
-    varEnv.Push(formal->name(), formal_loc);
+    if (formals_counter >= call.registers) {
+      varEnv.method_formals_.push_back(varEnv.method_args_ + (formals_counter - call.registers)*WORD_SIZE);
+    } else {
+      varEnv.method_formals_.push_back(pushed > 0 ? varEnv.method_args_ - (formals_counter + 2)*WORD_SIZE : -1);
+    }
+    varEnv.PushFrame(formal->name(), std::max(varEnv.method_formals_.back(), 0)); // unread if -1
   }
   
+  const int loads_removed = gCgenStats.loads_removed;
   body_->CodeGen(varEnv, os); // generate method body
+  if (gCgenStats.loads_removed > loads_removed) {
+    gCgenStats.numbered_methods[varEnv.klass_->name()->value() + "." + name_->value()].second
+      += gCgenStats.loads_removed - loads_removed;
+  }
   //int temporary_offset = varEnv.GetTemporaryMaxCount() * WORD_SIZE; // not sure why this was being used; redundant
   
   // pop entire AR off stack, NOT INCLUDING return addr. & arguments from caller
-  os << EX << rDE << "," << rHL << std::endl; // preserve return value
+  if (temp_count > 0) {
+    os << EX << rDE << "," << rHL << std::endl; // preserve return value
   
-  // not sure why temporary_offset was being used instead of temp_count...
-  //emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(temporary_offset * WORD_SIZE)), os);
-  emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(temp_count*WORD_SIZE)), os);
+    // not sure why temporary_offset was being used instead of temp_count...
+    //emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(temporary_offset * WORD_SIZE)), os);
+    emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(temp_count*WORD_SIZE)), os);
   
-  emit_add(rHL, RegisterValue(SP), os);
-  emit_load(RegisterValue(SP), RegisterValue(rHL), os);
-  os << EX << rDE << "," << rHL << std::endl;
-  emit_pop(SELF, os);
-  emit_pop(FP, os);
+    emit_add(rHL, RegisterValue(SP), os);
+    emit_load(RegisterValue(SP), RegisterValue(rHL), os);
+    os << EX << rDE << "," << rHL << std::endl;
+  }
+  if (use.self) {
+    emit_pop(SELF, os);
+  }
+  if (frame) {
+    emit_pop_frame(os);
+  }
+  for (int i = 0; i < pushed; ++i) {
+    emit_pop(rDE, os);
+  }
+  if (call.callee_pops && call.stack > 0) {
+    emit_pop(rBC, os); // return address
+    for (int i = 0; i < call.stack; ++i) {
+      emit_pop(rDE, os);
+    }
+    emit_push(rBC, os);
+  }
   
   emit_return(Flags::none, os);
+  varEnv.method_ = nullptr;
+  varEnv.method_frame_ = varEnv.method_self_ = true;
   
   // exit method scope
   for (Formals::const_iterator formals_it = formals_begin(); formals_it != formals_end(); ++formals_it) {
@@ -784,7 +1257,14 @@ void NoExpr::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
 }
 
 void Ref::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
-  if (name_ == self) {
+  if (CgenPassEnabled(PASS_LVN) && varEnv.AccHeld(os) == name_) {
+    ++gCgenStats.loads_removed; // still in ACC from the last load or store
+    return;
+  }
+  if (name_ == self && varEnv.keep_args_) {
+    emit_push(SELF, os);
+    emit_pop(ARG0, os);
+  } else if (name_ == self) {
   	// this extra step is necessary -- ld h,ixh isn't allowed
     emit_load(rDE, SELF, os);
     os << EX << rDE << "," << rHL << std::endl;
@@ -803,55 +1283,65 @@ void Ref::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   		const RegisterPointerOffset& ptr_off = (const RegisterPointerOffset&) loc;
   		emit_load(ARG0.low(), MemoryValue(ptr_off[0]), os);
   		emit_load(ARG0.high(), MemoryValue(ptr_off[1]), os);
+  	} else if (loc.kind() == MemoryLocation::Kind::PTR_FAR || loc.kind() == MemoryLocation::Kind::PTR_MEM) {
+  		emit_load(RegisterValue(ARG0), MemoryValue(loc), os);
   	} else {
   		assert (false);
   	}
   }
+  varEnv.SetAcc(name_, os);
+}
+
+// static types whose values may be tagged Ints or Bools (with cgen_tagged)
+static bool MayBeTagged(Symbol* type) {
+  return type == Object || type == Int || type == Bool;
+}
+
+// push ACC, which doesn't change what it holds
+static void emit_push_acc(VariableEnvironment& varEnv, std::ostream& os) {
+  Symbol* held = varEnv.AccHeld(os);
+  emit_push(ARG0, os);
+  varEnv.SetAcc(held, os);
 }
 
 void BinaryOperator::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
-  // is the resulting object a Bool? (otherwise an Int)
-//   if (lhs_->type() == Int) {
-  	if (type() == Int) {
+  if (CgenPassEnabled(PASS_STRENGTH) && CodeGenReduced(varEnv, os)) {
+    return;
+  }
+
+  if (type() == Bool) {
+  	// comparison: materialize the Bool from the flags
+  	const int l_true = label_counter++;
+  	const char* flag = CodeGenFlags(varEnv, os);
+  	if (flag == Flags::C && emit_template("ld hl,c?" + CgenRef(true) + ":" + CgenRef(false), os)) {
+  		return;
+  	}
+  	emit_load(RegisterValue(rHL), CgenRef(true), os);
+  	emit_jr(l_true, flag, os);
+  	emit_load(RegisterValue(rHL), CgenRef(false), os);
+  	emit_label_def(l_true, os);
+  	return;
+  }
+
+  	const bool late_boxing = gCgenKlassTable->LateBoxing();
+  	if (!late_boxing) {
 	  	// if result is Int, create new int object
   		emit_load(RegisterValue(ARG0), LabelValue(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX)), os);
-  		emit_copy(os);
+  		gCgenKlassTable->EmitCopy(Int, os);
 		emit_push(ARG0, os);
   	}
-	
-  	lhs_->CodeGen(varEnv, os);
-  	emit_push(ARG0, os);
-  	rhs_->CodeGen(varEnv, os);
-  	emit_pop(rDE, os);
   	
-  	if (lhs_->type() == Int) {
-  		// if LHS & RHS are Ints
-  		emit_fetch_int(RegisterValue(rBC), RegisterPointer(rHL), os);
-  		os << EX << rDE << "," << rHL << std::endl;
-  		emit_fetch_int(RegisterValue(rDE), RegisterPointer(rHL), os);
-  		os << EX << rDE << "," << rHL << std::endl;
-  	} else if (lhs_->type() == Bool) {
-  		// if LHS & RHS are bools
-  		emit_fetch_bool(RegisterValue(rBC), RegisterPointer(rHL), os);
-  		os << EX << rDE << "," << rHL << std::endl;
-  		emit_fetch_bool(RegisterValue(rDE), RegisterPointer(rHL), os);
-  		os << EX << rDE << "," << rHL << std::endl;
-  	} else {
-  		// else operands are objects
-  		os << EX << rDE << "," << rHL << std::endl;
-  		emit_load(rB, rD, os);
-  		emit_load(rC, rE, os);
-  	}
+  	CodeGenOperands(varEnv, os);
   	
   	// rHL = lhs, rBC = rhs
-  	const int l_true = label_counter++;
-  	const int l_end = label_counter++;
-  	
   	switch (kind_) {
   	case BO_Add:
   		emit_add(rHL, rBC, os);
   		break;
   	case BO_Sub:
+  		if (emit_template("sub hl,bc", os)) {
+  			break;
+  		}
   		// need to negate rBC
   		emit_cpl(rBC, os);
 		os << SCF << std::endl;
@@ -871,49 +1361,113 @@ void BinaryOperator::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   		emit_call(lib::DIV_HL_DE, nullptr, os);
   		break;
   		}
-	case BO_LT:
-		os << XOR << ACC << std::endl;
-		os << SBC << rHL << "," << rBC << std::endl;
-		os << ADD << rHL << "," << rHL << std::endl;
-		emit_load(RegisterValue(rHL), CgenRef(true), os);
-		emit_jr(l_true, Flags::C, os); // carry flag is set iff _lhs_ - _rhs_ < 0
-		emit_load(RegisterValue(rHL), CgenRef(false), os);
-		emit_label_def(l_true, os);
-		break;
-	case BO_LE:
-		os << SCF << std::endl;
-		os << SBC << rHL << "," << rBC << std::endl;
-		os << ADD << rHL << "," << rHL << std::endl;
-		emit_load(RegisterValue(rHL), CgenRef(true), os);
-		emit_jr(l_true, Flags::C, os);
-		emit_load(RegisterValue(rHL), CgenRef(false), os);
-		emit_label_def(l_true, os);
-		break;
-		
-	case BO_EQ:
-		os << XOR << rA << std::endl;
-		os << SBC << rHL << "," << rBC << std::endl;
-		emit_load(RegisterValue(rHL), CgenRef(true), os);
-		emit_jr(l_end, Flags::Z, os);
-		emit_load(RegisterValue(rHL), CgenRef(false), os);
-		emit_label_def(l_end, os);
-		break;
-	
   	default:
   		assert (false);
   	}
   	
-  	if (type() == Int) {
+  	if (late_boxing) {
+  		os << EX << "de,hl" << std::endl;
+  		gCgenKlassTable->EmitBoxInt(os);
+  	} else {
   		os << EX << "de,hl" << std::endl; // exchange values
   		emit_pop(ARG0, os); // pop off copied protoype int obj
   		const RegisterPointer new_int(ARG0);
   		emit_store_int(rDE, new_int, os);
+  	}
+}
+
+// evaluates the operands into HL (lhs) and BC (rhs): Ints and Bools as their values, other objects as pointers
+void BinaryOperator::CodeGenOperands(VariableEnvironment& varEnv, std::ostream& os) {
+  	// an Int operand is evaluated into its value instead of an object if it is the length of a String
+  	const bool unbox = cgen_tagged && lhs_->type() == Int;
+  	Dispatch* lhs_call = dynamic_cast<Dispatch*>(lhs_);
+  	const bool lhs_value = lhs_->type() == Int && lhs_call != nullptr && lhs_call->CodeGenIntValue(varEnv, os);
+  	if (!lhs_value) {
+  		lhs_->CodeGen(varEnv, os);
+  		if (unbox) {
+  			gCgenKlassTable->EmitUnboxInt(os);
+  		}
+  	}
+  	emit_push_acc(varEnv, os);
+  	Dispatch* rhs_call = dynamic_cast<Dispatch*>(rhs_);
+  	const bool rhs_value = rhs_->type() == Int && rhs_call != nullptr && rhs_call->CodeGenIntValue(varEnv, os);
+  	if (!rhs_value) {
+  		rhs_->CodeGen(varEnv, os);
+  		if (unbox) {
+  			gCgenKlassTable->EmitUnboxInt(os);
+  		}
+  	}
+  	emit_pop(rDE, os);
+  	
+  	if (lhs_->type() == Int && !cgen_tagged) {
+  		// if LHS & RHS are Ints
+  		if (rhs_value) {
+  			emit_load(RegisterValue(rBC), RegisterValue(rHL), os);
+  		} else {
+  			emit_fetch_int(RegisterValue(rBC), RegisterPointer(rHL), os);
+  		}
+  		os << EX << rDE << "," << rHL << std::endl;
+  		if (!lhs_value) {
+  			emit_fetch_int(RegisterValue(rDE), RegisterPointer(rHL), os);
+  			os << EX << rDE << "," << rHL << std::endl;
+  		}
+  	} else if (lhs_->type() == Bool && !cgen_tagged) {
+  		// if LHS & RHS are bools
+  		emit_fetch_bool(RegisterValue(rBC), RegisterPointer(rHL), os);
+  		os << EX << rDE << "," << rHL << std::endl;
+  		emit_fetch_bool(RegisterValue(rDE), RegisterPointer(rHL), os);
+  		os << EX << rDE << "," << rHL << std::endl;
   	} else {
-  		assert (type() == Bool);
-  		// ARG0 already equals bool
+  		// else operands are objects, unboxed Ints or tagged Bools
+  		os << EX << rDE << "," << rHL << std::endl;
+  		emit_load(rB, rD, os);
+  		emit_load(rC, rE, os);
   	}
 }
 
+// compares the operands by their static type: Ints and Bools by value, Strings by their characters
+// (String.equal_), two Objects by equality_test, since either may be an Int, Bool or String, and any other
+// objects by address
+const char* BinaryOperator::CodeGenFlags(VariableEnvironment& varEnv, std::ostream& os) {
+  Symbol* type = lhs_->type();
+  if (kind_ == BO_EQ && type != Int && type != Bool) {
+  	lhs_->CodeGen(varEnv, os);
+  	emit_push_acc(varEnv, os);
+  	rhs_->CodeGen(varEnv, os);
+  	emit_pop(rDE, os);
+  	if (type == String) {
+  		emit_string_equality_test(os);
+  	} else if (type == Object && rhs_->type() == Object) {
+  		emit_equality_test(os);
+  	} else {
+  		os << OR << rA << std::endl;
+  		os << SBC << rHL << "," << rDE << std::endl;
+  	}
+  	return Flags::Z;
+  }
+
+  CodeGenOperands(varEnv, os);
+  switch (kind_) {
+  case BO_LT:
+  	os << XOR << ACC << std::endl;
+  	os << SBC << rHL << "," << rBC << std::endl;
+  	os << ADD << rHL << "," << rHL << std::endl;
+  	return Flags::C; // carry flag is set iff _lhs_ - _rhs_ < 0
+  case BO_LE:
+  	os << SCF << std::endl;
+  	os << SBC << rHL << "," << rBC << std::endl;
+  	os << ADD << rHL << "," << rHL << std::endl;
+  	return Flags::C;
+  case BO_EQ:
+  	os << XOR << rA << std::endl;
+  	os << SBC << rHL << "," << rBC << std::endl;
+  	return Flags::Z;
+  default:
+  	assert (false);
+  	return Flags::none;
+  }
+}
+
 void UnaryOperator::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
 	const int l_end = label_counter++;
 
@@ -922,25 +1476,45 @@ void UnaryOperator::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
    {
   	assert (input_->type() == Int);
   	
-  	const std::string protobj(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX));
-  	emit_load(RegisterValue(ARG0), LabelValue(protobj), os);
-  	emit_copy(os);
-  	emit_push(ARG0, os);
+  	const bool late_boxing = gCgenKlassTable->LateBoxing();
+  	if (!late_boxing) {
+  		const std::string protobj(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX));
+  		emit_load(RegisterValue(ARG0), LabelValue(protobj), os);
+  		gCgenKlassTable->EmitCopy(Int, os);
+  		emit_push(ARG0, os);
+  	}
   	
   	input_->CodeGen(varEnv, os);
   	
-  	emit_fetch_int(rDE, RegisterPointer(ARG0), os);
-  	emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(0)), os);
-	os << XOR << rA << std::endl;
-	os << SBC << rHL << "," << rDE << std::endl;
+  	if (cgen_tagged) {
+  		gCgenKlassTable->EmitUnboxInt(os);
+  		os << EX << rDE << "," << rHL << std::endl;
+  	} else {
+  		emit_fetch_int(rDE, RegisterPointer(ARG0), os);
+  	}
+  	if (!emit_template("ld hl,-de", os)) {
+  		emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(0)), os);
+		os << XOR << rA << std::endl;
+		os << SBC << rHL << "," << rDE << std::endl;
+	}
 	os << EX << rDE << "," << rHL << std::endl;
-	emit_pop(ARG0, os);
-	emit_store_int(rDE, RegisterPointer(ARG0), os);
+	if (late_boxing) {
+		gCgenKlassTable->EmitBoxInt(os);
+	} else {
+		emit_pop(ARG0, os);
+		emit_store_int(rDE, RegisterPointer(ARG0), os);
+	}
 	break;
   	}
   case UO_Not:
   	assert (input_->type() == Bool);
   	input_->CodeGen(varEnv, os);
+  	if (cgen_tagged) {
+  		os << LD << rA << "," << rL << std::endl;
+  		os << XOR << (TAGGED_FALSE ^ TAGGED_TRUE) << std::endl;
+  		os << LD << rL << "," << rA << std::endl;
+  		break;
+  	}
   	emit_fetch_bool(rDE, RegisterPointer(ARG0), os);
   	os << LD << rA << "," << rD << std::endl;
   	os << OR << rE << std::endl;
@@ -992,39 +1566,39 @@ void Knew::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   	emit_push(rBC, os); // init method
   	os << EX << rDE << "," << rHL << std::endl; // HL = new obj
   	emit_return(nullptr, os); // hacky function call equivalent
+  } else if (cgen_tagged && name_ == Int) {
+  	emit_load(RegisterValue(ARG0), CgenRef(gIntTable.emplace(0)), os);
+  } else if (cgen_tagged && name_ == Bool) {
+  	emit_load(RegisterValue(ARG0), CgenRef(false), os);
   } else {
   	const std::string prot = std::string(name_->value()) + std::string(PROTOBJ_SUFFIX);
   	emit_load(RegisterValue(ARG0), LabelValue(prot), os);
-  	emit_copy(os);
-  	emit_init(name_, os);  
+  	gCgenKlassTable->EmitCopy(name_, os);
+  	if (!gCgenKlassTable->ClassFind(name_)->EmptyInitializer()) {
+  	  emit_init(name_, os);
+  	}
   }
 }
 
 void KaseBranch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   // need to store location
-  RegisterPointerOffset branch_var_loc(FP, varEnv.GetTemporaryCount() * WORD_SIZE);
-  varEnv.Push(name_, branch_var_loc);
-  varEnv.IncTemporaryCount();
+  varEnv.PushFrame(name_, slot_*WORD_SIZE);
   
   // expect address of evaluated objetc expr0 to be held on top of stack
  // emit_load(branch_var_loc, rBC, os);	// save expr0 object
 	emit_pop(rDE, os);
-	emit_load(branch_var_loc, rDE, os);
+	emit_load(MemoryValue(varEnv.Lookup(name_)), rDE, os);
   
   body_->CodeGen(varEnv, os);
   
   varEnv.Pop(name_);
-  varEnv.DecTemporaryCount();
 }
 
 void Kase::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
-	const CgenNode *input_node;
 	std::unordered_map<const KaseBranch *, const CgenNode *> branch2node;
 	std::vector<KaseBranch *> branches;
 	std::unordered_map<KaseBranch *, int> branch2label;
 	
-	input_node = gCgenKlassTable->ClassFind(input_->type());
-	
 	// construct KaseBranch-to-CgenNode table and branches vector
 	for (KaseBranch *branch : *cases_) {
 		branch2node[branch] = gCgenKlassTable->ClassFind(branch->decl_type());
@@ -1040,54 +1614,108 @@ void Kase::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
 		return left_depth > right_depth;
 	};
 	
-	// sort the branches
-	std::sort(branches.begin(), branches.end(), sort_branches);
+	// sort the branches, most specific first: a branch's tag interval contains
+	// the intervals of all branches for its subclasses
+	std::stable_sort(branches.begin(), branches.end(), sort_branches);
 
+	// tags covered by the branches
+	int min_tag = branch2node[branches.front()]->tag();
+	int max_tag = branch2node[branches.front()]->max_tag();
+	for (KaseBranch *branch : branches) {
+		min_tag = std::min<int>(min_tag, branch2node[branch]->tag());
+		max_tag = std::max<int>(max_tag, branch2node[branch]->max_tag());
+	}
+	const int span = max_tag - min_tag + 1;
+	const bool small_tags = (gCgenKlassTable->root()->max_tag() < 256); // tags fit in a byte
+	
 	//-- ASSEMBLY CODE GENERATION STARTS HERE --//
 	int abort_label = label_counter++;
+	int void_label = label_counter++;
 	int end_label = label_counter++;
 	
 	// evaluate input expression
 	input_->CodeGen(varEnv, os);
+	os << XOR << ACC << std::endl;
+	emit_or(rH, os);
+	emit_or(rL, os);
+	emit_jp(void_label, Flags::Z, os); // case on void
 	emit_push(ARG0, os); // preserve address of input object
 	
 	// set rBC = tag of input object in rHL
-	emit_load(RegisterValue(rBC), RegisterPointer(ARG0), os);
+	if (cgen_tagged && MayBeTagged(input_->type())) {
+		emit_call(AbsoluteAddress("_object_tag"), Flags::none, os);
+	} else {
+		emit_load(RegisterValue(rBC), RegisterPointer(ARG0), os);
+	}
 	
-	// generate inheritance search code for each branch
-	for (KaseBranch *branch : branches) {
-		int branch_tag = branch2node[branch]->tag();
-		int16_t tree_offset = CgenLayout::InheritanceTree::entry_length * branch_tag;
-		os << LD << rHL << "," << INHERITANCE_TREE << "+" << tree_offset << std::endl;
+	if (small_tags && branches.size() >= 4 && span <= 4 * (int) branches.size()) {
+		// dense case: jump table indexed by tag, holding the most specific branch for each tag
+		int table_label = label_counter++;
+		os << LD << rA << "," << rC << std::endl;
+		if (min_tag != 0) {
+			os << SUB << min_tag << std::endl;
+		}
+		os << CP << span << std::endl;
+		emit_jp(abort_label, Flags::NC, os);
+		os << LD << rL << "," << rA << std::endl;
+		os << LD << rH << "," << 0 << std::endl;
+		emit_add(ARG0, ARG0, os);
+		emit_load(RegisterValue(rDE), LabelValue(label_ref(table_label)), os);
+		emit_add(ARG0, rDE, os);
+		emit_load(RegisterValue(rA), RegisterPointer(ARG0), os);
+		os << INC << rHL << std::endl;
+		os << LD << rH << "," << MemoryValue(RegisterPointer(ARG0)) << std::endl;
+		os << LD << rL << "," << rA << std::endl;
+		os << JP << "(" << rHL << ")" << std::endl;
 		
-		// inheritance tree traversal loop
-		int loop_label = label_counter++;
-		int branch_label = branch2label[branch];
-		emit_label_def(loop_label, os);
-			emit_load(RegisterValue(rDE), RegisterPointer(rHL), os);
-			os << EX << rDE << "," << rHL << std::endl;
-			os << XOR << rA << std::endl;
-			os << SBC << rHL << "," << rBC << std::endl; // compare tags
-			emit_jp(branch_label, Flags::Z, os); // if tags equal, go to branch
-			
-			// otherwise, compute parent node
-			os << EX << rDE << "," << rHL << std::endl;
-			os << INC << rHL << std::endl;
-			os << INC << rHL << std::endl; // rHL points to offset in tree
-			emit_load(RegisterValue(rDE), RegisterPointer(rHL), os);
-			emit_add(RegisterValue(rHL), RegisterValue(rDE), os);
-						
-			// test if offset is 0
-			os << LD << rA << "," << rD << std::endl;
-			os << OR << rE << std::endl;
-			emit_jr(loop_label, Flags::NZ, os);
-			
-			// next case follows
+		emit_label_def(table_label, os);
+		for (int tag = min_tag; tag <= max_tag; ++tag) {
+			int target = abort_label;
+			for (KaseBranch *branch : branches) {
+				if (branch2node[branch]->tag() <= tag && tag <= branch2node[branch]->max_tag()) {
+					target = branch2label[branch];
+					break;
+				}
+			}
+			os << DW << label_ref(target) << std::endl;
+		}
+	} else {
+		// range check for each branch: tag() <= tag <= max_tag()
+		for (KaseBranch *branch : branches) {
+			const CgenNode *node = branch2node[branch];
+			int branch_label = branch2label[branch];
+			int size = node->max_tag() - node->tag() + 1;
+			if (node == gCgenKlassTable->root()) {
+				emit_jp(branch_label, nullptr, os); // Object matches everything
+				break;
+			} else if (small_tags) {
+				os << LD << rA << "," << rC << std::endl;
+				if (node->tag() != 0) {
+					os << SUB << node->tag() << std::endl;
+				}
+				os << CP << size << std::endl;
+				emit_jp(branch_label, Flags::C, os);
+			} else {
+				emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(-node->tag())), os);
+				emit_add(ARG0, rBC, os);
+				emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(-size)), os);
+				emit_add(ARG0, rDE, os); // carry iff tag - tag() >= size (unsigned)
+				emit_jp(branch_label, Flags::NC, os);
+			}
+		}
 	}
 	
+	// no branch matched
 	emit_label_def(abort_label, os);
-		os << BREAK << std::endl; // TO BE IMPLEMENTED
-		
+	emit_pop(ARG0, os);
+	const AbsoluteAddress case_abort("_case_abort");
+	emit_jp(case_abort, Flags::none, os);
+	
+	emit_label_def(void_label, os);
+	emit_load(RegisterValue(rDE), Immediate16(static_cast<uint16_t>(this->loc())), os);
+	emit_load(RegisterValue(ARG0), CgenRef(gStringTable.lookup(varEnv.klass_->filename()->value())), os);
+	const AbsoluteAddress case_abort2("_case_abort2");
+	emit_jp(case_abort2, Flags::none, os);
 		
 	// codegen branches
 	for (KaseBranch *branch : branches) {
@@ -1298,19 +1926,24 @@ void Kase::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
 
 void Let::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   // SELF_TYPE not allowed, so don't need to consider
-  RegisterPointerOffset let_var(FP, varEnv.GetTemporaryCount()*WORD_SIZE);
-	varEnv.IncTemporaryCount();
   varEnv.init_type_ = decl_type_;
   
-  init_->CodeGen(varEnv, os);
-  varEnv.Push(name_, let_var);
-  emit_load(let_var, ARG0, os);
+  if (!init_dead_) {
+    init_->CodeGen(varEnv, os);
+    varEnv.PushFrame(name_, slot_*WORD_SIZE);
+    emit_load(MemoryValue(varEnv.Lookup(name_)), ARG0, os);
+    varEnv.SetAcc(name_, os);
+  } else {
+    if (dynamic_cast<NoExpr*>(init_) == nullptr) {
+      init_->CodeGen(varEnv, os); // only for its side effects
+    }
+    varEnv.PushFrame(name_, slot_*WORD_SIZE);
+  }
   
   body_->CodeGen(varEnv, os);
   
   varEnv.Pop(name_);
   varEnv.init_type_ = nullptr;
-  varEnv.DecTemporaryCount();
 }
 
 void Block::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
@@ -1319,19 +1952,82 @@ void Block::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   }
 }
 
+// sets Z iff the Bool in ACC is false
+static void emit_test_bool(const Register16& scrap, std::ostream& os) {
+  if (cgen_tagged) {
+    os << BIT << "0," << rL << std::endl; // TAGGED_TRUE is odd, TAGGED_FALSE even
+  } else {
+    emit_fetch_bool(RegisterValue(scrap), RegisterPointer(ARG0), os);
+    os << XOR << ACC << std::endl;
+    emit_or(scrap.high(), os);
+    emit_or(scrap.low(), os);
+  }
+}
+
+static const char* InverseFlag(const char* flag) {
+  return (flag == Flags::C) ? Flags::NC : (flag == Flags::NC) ? Flags::C : (flag == Flags::Z) ? Flags::NZ : Flags::Z;
+}
+
+// evaluates the Bool pred and jumps to label if it is when
+static void emit_branch_bool(Expression* pred, bool when, int label, const Register16& scrap,
+                             VariableEnvironment& varEnv, std::ostream& os) {
+  if (CgenPassEnabled(PASS_COMPARE) && pred->CodeGenBranch(when, label, varEnv, os)) {
+    ++gCgenStats.flag_branches;
+    return;
+  }
+  pred->CodeGen(varEnv, os);
+  emit_test_bool(scrap, os);
+  emit_jp(label, when ? Flags::NZ : Flags::Z, os);
+}
+
+bool BinaryOperator::CodeGenBranch(bool when, int label, VariableEnvironment& varEnv, std::ostream& os) {
+  if (type() != Bool) {
+    return false;
+  }
+  const char* flag = CodeGenFlags(varEnv, os);
+  emit_jp(label, when ? flag : InverseFlag(flag), os);
+  return true;
+}
+
+bool UnaryOperator::CodeGenBranch(bool when, int label, VariableEnvironment& varEnv, std::ostream& os) {
+  switch (kind_) {
+  case UO_Not:
+    emit_branch_bool(input_, !when, label, rDE, varEnv, os);
+    return true;
+  case UO_IsVoid:
+    input_->CodeGen(varEnv, os);
+    os << LD << rA << "," << rH << std::endl;
+    os << OR << rL << std::endl;
+    emit_jp(label, when ? Flags::Z : Flags::NZ, os);
+    return true;
+  default:
+    return false;
+  }
+}
+
 void Loop::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   int label_loop_pred = label_counter++;
   int label_loop_end = label_counter++;
   
+  gCgenProfile.EmitCount(this, 0, os);
+  // testing at the bottom costs a jump on entry but saves one per iteration
+  if (CgenPassEnabled(PASS_PROFILE) && gCgenProfile.Count(this, 1) > gCgenProfile.Count(this, 0)) {
+    ++gCgenStats.rotated_loops;
+    const int label_loop_body = label_counter++;
+    emit_jp(label_loop_pred, nullptr, os);
+    emit_label_def(label_loop_body, os);
+    gCgenProfile.EmitCount(this, 1, os);
+    body_->CodeGen(varEnv, os);
+    emit_label_def(label_loop_pred, os);
+    emit_branch_bool(pred_, true, label_loop_body, rBC, varEnv, os);
+    emit_load(RegisterValue(ARG0), Immediate16(static_cast<int16_t>(0)), os); // loop evaluates to void
+    return;
+  }
+
   emit_label_def(label_loop_pred, os);
-  pred_->CodeGen(varEnv, os);
-  emit_fetch_bool(RegisterValue(rBC), RegisterPointer(ARG0), os);
-//   emit_beqz(ACC, label_loop_end, os);
-  os << XOR << ACC << std::endl;
-  emit_or(rB, os);
-  emit_or(rC, os);
-  emit_jp(label_loop_end, Flags::Z, os);
+  emit_branch_bool(pred_, false, label_loop_end, rBC, varEnv, os);
   
+  gCgenProfile.EmitCount(this, 1, os);
   body_->CodeGen(varEnv, os);
   emit_jp(label_loop_pred, nullptr, os);
   
@@ -1343,26 +2039,232 @@ void Cond::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   int label_else = label_counter++;
   int label_fi = label_counter++;
   
-  // evaluate predicate
-  pred_->CodeGen(varEnv, os); // if
-  emit_fetch_bool(RegisterValue(rDE), RegisterPointer(ARG0), os); // get bool value
-  os << XOR << ACC << std::endl;
-  emit_or(rD, os);
-  emit_or(rE, os);
-  emit_jp(label_else, Flags::Z, os);
-//   emit_beqz(ACC, label_else, os); // branch to 'else' if false
+  // the arm branched to is cheaper than the one fallen into, which jumps over the other
+  if (CgenPassEnabled(PASS_PROFILE) && gCgenProfile.Count(this, 0) > gCgenProfile.Count(this, 1)) {
+    ++gCgenStats.hot_arms;
+    const int label_then = label_counter++;
+    emit_branch_bool(pred_, true, label_then, rDE, varEnv, os); // if
+    gCgenProfile.EmitCount(this, 1, os);
+    else_branch_->CodeGen(varEnv, os); // else
+    emit_jp(label_fi, nullptr, os);
+    emit_label_def(label_then, os); // then
+    gCgenProfile.EmitCount(this, 0, os);
+    then_branch_->CodeGen(varEnv, os);
+    emit_label_def(label_fi, os); // fi
+    return;
+  }
+
+  emit_branch_bool(pred_, false, label_else, rDE, varEnv, os); // if
   
+  gCgenProfile.EmitCount(this, 0, os);
   then_branch_->CodeGen(varEnv, os); // then
 //   emit_branch(label_fi, os);
 	emit_jp(label_fi, nullptr, os);
   
   emit_label_def(label_else, os); // else
+  gCgenProfile.EmitCount(this, 1, os);
   else_branch_->CodeGen(varEnv, os);
   
   emit_label_def(label_fi, os); // fi
 }
 
+const Symbol* StaticDispatch::DirectTarget(Klass* klass) const {
+  // the implementation dispatch_type_ inherits (it need not define the method itself)
+  return gCgenKlassTable->ClassFind(dispatch_type_)->dispTab()[name_].klass_;
+}
+
 void StaticDispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
+  CodeGenKnown(DirectTarget(varEnv.klass_), varEnv, os);
+}
+
+// evaluates into ACC without changing DE or BC (self with keep_args_)
+static bool PreservesArgs(Expression* expr) {
+  return dynamic_cast<Ref*>(expr) != nullptr || dynamic_cast<IntLiteral*>(expr) != nullptr
+    || dynamic_cast<StringLiteral*>(expr) != nullptr || dynamic_cast<BoolLiteral*>(expr) != nullptr;
+}
+
+// pushes the stack arguments, then return_label (if >= 0), then the register arguments, which
+// with load end up in DE and BC instead; a register argument stays in its register if what is
+// evaluated after it can't change it
+void Dispatch::CodeGenActuals(const CallConvention& call, bool load, int return_label, VariableEnvironment& varEnv,
+                              std::ostream& os) {
+  const int count = actuals_->size();
+  const bool keep_de = load && call.registers > 0 && PreservesArgs(receiver_);
+  const bool keep_bc = keep_de && call.registers > 1 && PreservesArgs(actuals_->at(count - 1));
+  for (int i = 0; i <= count; ++i) {
+    if (i == call.stack && return_label >= 0) {
+      emit_load(RegisterValue(rDE), LabelValue(label_ref(return_label)), os);
+      emit_push(rDE, os);
+    }
+    if (i == count) {
+      break;
+    }
+    actuals_->at(i)->CodeGen(varEnv, os);
+    if (i == count - 1 && keep_de) {
+      os << EX << rDE << "," << rHL << std::endl;
+    } else if (i == count - 2 && keep_bc) {
+      emit_load(RegisterValue(rBC), RegisterValue(ARG0), os);
+    } else {
+      emit_push_acc(varEnv, os);
+    }
+  }
+
+  varEnv.keep_args_ = keep_de;
+  receiver_->CodeGen(varEnv, os);
+  varEnv.keep_args_ = false;
+  if (load && call.registers > 0 && !keep_de) {
+    emit_pop(rDE, os);
+  }
+  if (load && call.registers > 1 && !keep_bc) {
+    emit_pop(rBC, os);
+  }
+  gCgenStats.register_args += call.registers;
+  gCgenStats.unpushed_args += keep_de + keep_bc;
+}
+
+void Dispatch::CodeGenInline(VariableEnvironment& varEnv, std::ostream& os) {
+  const int dispatch_ok = label_counter++;
+
+  // 1. evaluate actuals into frame slots
+  for (std::size_t i = 0; i < actuals_->size(); ++i) {
+    actuals_->at(i)->CodeGen(varEnv, os);
+    emit_load(MemoryValue(*FrameLocation(inline_slots_[i]*WORD_SIZE)), ARG0, os);
+  }
+
+  // 2. evaluate receiver; self is never void and is already bound
+  Ref* ref = dynamic_cast<Ref*>(receiver_);
+  const bool rebind = (ref == nullptr || ref->name() != self);
+  receiver_->CodeGen(varEnv, os);
+  if (rebind) {
+    os << XOR << ACC << std::endl;
+    emit_or(rH, os);
+    emit_or(rL, os);
+    emit_jr(dispatch_ok, Flags::NZ, os);
+    emit_load(RegisterValue(rDE), Immediate16(static_cast<uint16_t>(this->loc())), os);
+    emit_load(RegisterValue(ARG0), CgenRef(gStringTable.lookup(varEnv.klass_->filename()->value())), os);
+    const AbsoluteAddress disp_abort("_dispatch_abort");
+    emit_jp(disp_abort, Flags::none, os);
+    emit_label_def(dispatch_ok, os);
+  }
+  gCgenProfile.EmitReceiver(this, os);
+  gCgenProfile.EmitCount(inline_, 0, os);
+  if (rebind) {
+    emit_push(SELF, os);
+    os << EX << rDE << "," << rHL << std::endl;
+    emit_load(RegisterValue(SELF), RegisterValue(rDE), os); // bind self, but can only do it with DE -> IX
+  }
+
+  // 3. callee body sees its own class's attributes and formals bound to the slots above
+  CgenNode* callee_klass = gCgenKlassTable->ClassFind(inline_klass_->name());
+  VariableEnvironment callee_env(callee_klass->attrVarEnv());
+  callee_env.klass_ = inline_klass_;
+  callee_env.init_type_ = nullptr;
+  callee_env.method_ = nullptr;
+  std::vector<int>::const_iterator slot = inline_slots_.begin();
+  for (Formals::const_iterator formals_it = inline_->formals_begin(); formals_it != inline_->formals_end(); ++formals_it) {
+    callee_env.PushFrame((*formals_it)->name(), *slot++ * WORD_SIZE);
+  }
+  inline_->body()->CodeGen(callee_env, os);
+
+  if (rebind) {
+    emit_pop(SELF, os);
+  }
+}
+
+void Dispatch::CodeGenKnown(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os) {
+  if (CgenPassEnabled(PASS_INTRINSICS) && CodeGenIntrinsic(klass, varEnv, os)) {
+    return;
+  } else if (inline_ != nullptr) {
+    CodeGenInline(varEnv, os);
+  } else if (CanTailCall(klass, varEnv)) {
+    CodeGenTail(klass, varEnv, os);
+  } else {
+    CodeGenDirect(klass, varEnv, os);
+  }
+}
+
+void Dispatch::CodeGenTail(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os) {
+  const int dispatch_abort = label_counter++;
+  const bool recursive = (klass == varEnv.klass_->name() && name_ == varEnv.method_->name());
+  ++gCgenStats.tail_calls;
+
+  // 1. evaluate actuals & receiver, as for a call
+  for (Expression* expr : *actuals_) {
+    expr->CodeGen(varEnv, os);
+    emit_push_acc(varEnv, os);
+  }
+
+  Ref* ref = dynamic_cast<Ref*>(receiver_);
+  const bool rebind = (ref == nullptr || ref->name() != self);
+  receiver_->CodeGen(varEnv, os);
+  if (rebind) {
+    os << XOR << ACC << std::endl;
+    emit_or(rH, os);
+    emit_or(rL, os);
+    emit_jr(dispatch_abort, Flags::Z, os); // abort if receiver is void
+  }
+  gCgenProfile.EmitReceiver(this, os);
+
+  // 2. overwrite this method's arguments (same count) with the actuals, last actual first; another
+  // callee gets its register arguments in DE and BC (and then has no stack arguments, see CanTailCall)
+  const int count = actuals_->size();
+  const int registers = recursive ? 0 : CgenCallConvention(name_, count).registers;
+  if (registers > 0) {
+    emit_pop(rDE, os);
+  }
+  if (registers > 1) {
+    emit_pop(rBC, os);
+  }
+  for (int i = registers; i < count; ++i) {
+    emit_pop(rDE, os);
+    if (varEnv.method_formals_[count - 1 - i] >= 0) {
+      emit_load(MemoryValue(*FrameLocation(varEnv.method_formals_[count - 1 - i])), rDE, os);
+    }
+  }
+
+  if (recursive) {
+    // 3a. same frame layout: rebind self and restart the body
+    ++gCgenStats.tail_recursions;
+    if (rebind && varEnv.method_self_) {
+      os << EX << rDE << "," << rHL << std::endl;
+      emit_load(RegisterValue(SELF), RegisterValue(rDE), os);
+    }
+    emit_jp(varEnv.method_entry_, nullptr, os);
+  } else {
+    // 3b. pop this method's frame (as in its epilogue), then jump to the callee, which returns to our caller
+    if (varEnv.method_temps_ > 0 && registers > 0) {
+      for (int i = 0; i < varEnv.method_temps_; ++i) {
+        emit_pop(rAF, os); // HL, DE and BC are taken
+      }
+    } else if (varEnv.method_temps_ > 0) {
+      os << EX << rDE << "," << rHL << std::endl; // preserve receiver
+      emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(varEnv.method_temps_*WORD_SIZE)), os);
+      emit_add(rHL, RegisterValue(SP), os);
+      emit_load(RegisterValue(SP), RegisterValue(rHL), os);
+      os << EX << rDE << "," << rHL << std::endl;
+    }
+    if (varEnv.method_self_) {
+      emit_pop(SELF, os);
+    }
+    if (varEnv.method_frame_) {
+      emit_pop_frame(registers > 0, os);
+    }
+    for (int i = 0; i < varEnv.method_pushed_; ++i) {
+      emit_pop(registers > 0 ? rAF : rDE, os);
+    }
+    os << JP << klass->value() << METHOD_SEP << name_ << std::endl;
+  }
+
+  if (rebind) {
+    emit_label_def(dispatch_abort, os);
+    emit_load(RegisterValue(rDE), Immediate16(static_cast<uint16_t>(this->loc())), os);
+    emit_load(RegisterValue(ARG0), CgenRef(gStringTable.lookup(varEnv.klass_->filename()->value())), os);
+    const AbsoluteAddress disp_abort("_dispatch_abort");
+    emit_jp(disp_abort, Flags::none, os);
+  }
+}
+
+void Dispatch::CodeGenDirect(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os) {
   const int dispatch_end = label_counter;
   const int dispatch_abort = label_counter+1;
   label_counter += 2;
@@ -1371,19 +2273,16 @@ void StaticDispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   // 2. evaluate receiver
   
 //   emit_push(RA, os);
-  for (Expression* expr : *actuals_) {
-    expr->CodeGen(varEnv, os);
-    emit_push(ARG0, os);
-  }
-
-  receiver_->CodeGen(varEnv, os);
+  const CallConvention call = CgenCallConvention(name_, actuals_->size());
+  CodeGenActuals(call, true, -1, varEnv, os);
   os << XOR << ACC << std::endl;
   emit_or(rH, os);
   emit_or(rL, os);
   emit_jr(dispatch_abort, Flags::Z, os); // abort if receiver is void
+  gCgenProfile.EmitReceiver(this, os);
   
-  // call static method on given class
-  os << CALL << dispatch_type_ << METHOD_SEP << name_ << std::endl;
+  // call method of given class
+  os << CALL << klass->value() << METHOD_SEP << name_ << std::endl;
   /*
   std::string dispatch_str = std::string(DISPENT_PREFIX) + dispatch_type_->value() 
      + std::string(METHOD_SEP) + name_->value();
@@ -1391,7 +2290,7 @@ void StaticDispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   emit_bcall(dispatch_addr, os); // bcall method
   */
 
-  for (Expression *expr : *actuals_) {
+  for (int i = 0; i < (call.callee_pops ? 0 : call.stack); ++i) {
      emit_pop(rDE, os); // pop off args
   }
   
@@ -1406,49 +2305,104 @@ void StaticDispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
 	emit_label_def(dispatch_end, os);
 }
 
+const Symbol* Dispatch::DirectTarget(Klass* klass) const {
+  if (!CgenPassEnabled(PASS_DEVIRTUALIZE)) {
+    return nullptr;
+  }
+  Symbol* static_type = (receiver_->type() == SELF_TYPE) ? klass->name() : receiver_->type();
+  return gCgenKlassTable->DispatchTarget(static_type, name_);
+}
+
 void Dispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
+  ++gCgenStats.dispatches;
+  // devirtualize if no subclass of the static type overrides the method
+  const Symbol* target = DirectTarget(varEnv.klass_);
+  if (target != nullptr) {
+    ++gCgenStats.devirtualized;
+    CodeGenKnown(target, varEnv, os);
+    return;
+  }
+
+  Symbol* static_type = (receiver_->type() == SELF_TYPE) ? varEnv.klass_->name() : receiver_->type();
+
   const int dispatch_end = label_counter++;
   const int dispatch_abort = label_counter++;
 
-  for (Expression* expr : *actuals_) {
-    expr->CodeGen(varEnv, os);
-    emit_push(ARG0, os);
-  }
-  
-  receiver_->CodeGen(varEnv, os);
+  // the return address goes below register arguments, which are then found with A and HL only;
+  // no method of Object, Int or Bool takes any, so their receivers are never tagged
+  const CallConvention call = CgenCallConvention(name_, actuals_->size());
+  assert (call.registers == 0 || !MayBeTagged(static_type));
+  CodeGenActuals(call, true, call.registers > 0 ? dispatch_end : -1, varEnv, os);
   os << XOR << ACC << std::endl;
   emit_or(rH, os);
   emit_or(rL, os);
   emit_jr(dispatch_abort, Flags::Z, os); // if receiver is void, call dispatch_abort
+  gCgenProfile.EmitReceiver(this, os);
+
+  // with a profile, call the method of the class most receivers were of directly if it's that class
+  const CgenNode* hot = CgenPassEnabled(PASS_PROFILE) ? gCgenProfile.HotReceiver(this) : nullptr;
+  if (hot != nullptr && gCgenKlassTable->root()->max_tag() <= UINT8_MAX) {
+    ++gCgenStats.guarded;
+    const int dispatch_table = label_counter++;
+    const Symbol* impl = gCgenKlassTable->ClassFind(hot->name())->dispTab()[name_].klass_;
+    // subclasses that don't override the method pass the same test
+    const int last = hot->OverriddenBelow(name_, impl) ? hot->tag() : hot->max_tag();
+    if (cgen_tagged && MayBeTagged(static_type)) {
+      os << LD << rA << "," << rH << std::endl;
+      os << AND << "$C0" << std::endl;
+      emit_jr(dispatch_table, Flags::Z, os); // tagged Int or Bool
+    }
+    os << LD << rA << ",(" << rHL << ")" << std::endl; // class tag (high byte is 0)
+    if (last == hot->tag()) {
+      os << CP << hot->tag() << std::endl;
+      emit_jr(dispatch_table, Flags::NZ, os);
+    } else {
+      os << SUB << hot->tag() << std::endl;
+      os << CP << last - hot->tag() + 1 << std::endl;
+      emit_jr(dispatch_table, Flags::NC, os);
+    }
+    if (call.registers > 0) {
+      os << JP << impl->value() << METHOD_SEP << name_ << std::endl;
+    } else {
+      os << CALL << impl->value() << METHOD_SEP << name_ << std::endl;
+      emit_jr(dispatch_end, Flags::none, os);
+    }
+    emit_label_def(dispatch_table, os);
+  }
   
-  emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(DISPTABLE_OFFSET * WORD_SIZE)),
-            os);
-  os << EX << rDE << "," << rHL << std::endl;
-  emit_add(ARG0, rDE, os); // ARG0 -> pointer to disptable for class
-  emit_load(RegisterValue(rBC), RegisterPointer(ARG0), os); // rBC = address of disptable
-  
-  int16_t method_offset;
-  CgenNode *klass;
-  if (receiver_->type() == SELF_TYPE) {
-     klass = gCgenKlassTable->ClassFind(varEnv.klass_->name());
-     //method_offset = gCgenDispatchTables[varEnv.klass_->name()][name_].loc_.offset();
+  int16_t method_offset = gCgenKlassTable->DispatchOffset(static_type, name_);
+  if (call.registers > 0) {
+    emit_push(ARG0, os);
+    emit_add_hl(DISPTABLE_OFFSET * WORD_SIZE, os);
+    emit_load_hl_indirect(os); // address of disptable
+    emit_add_hl(method_offset, os);
+    emit_load_hl_indirect(os); // address of function to call
+    os << EX << "(" << SP << ")," << rHL << std::endl;
+    emit_return(Flags::none, os); // jp to it, with rHL = receiver
+  } else if (cgen_tagged && MayBeTagged(static_type)) {
+    emit_call(AbsoluteAddress("_object_disptab"), Flags::none, os); // rBC = address of disptable
+    os << EX << rDE << "," << rHL << std::endl;
   } else {
-     klass = gCgenKlassTable->ClassFind(receiver_->type());
-     //method_offset = gCgenDispatchTables[receiver_->type()][name_].loc_.offset();
+    emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(DISPTABLE_OFFSET * WORD_SIZE)),
+              os);
+    os << EX << rDE << "," << rHL << std::endl;
+    emit_add(ARG0, rDE, os); // ARG0 -> pointer to disptable for class
+    emit_load(RegisterValue(rBC), RegisterPointer(ARG0), os); // rBC = address of disptable
   }
-  method_offset = klass->dispTab()[name_].loc_.offset();
   
-  emit_load(RegisterValue(ARG0), Immediate16(method_offset), os);
-  emit_add(ARG0, rBC, os); // ARG0 = pointer to address of function to call
-  emit_load(RegisterValue(rBC), RegisterPointer(rHL), os); // rBC = address of funciton to call
+  if (call.registers == 0) {
+    emit_load(RegisterValue(ARG0), Immediate16(method_offset), os);
+    emit_add(ARG0, rBC, os); // ARG0 = pointer to address of function to call
+    emit_load(RegisterValue(rBC), RegisterPointer(rHL), os); // rBC = address of funciton to call
   
-  os << EX << rDE << "," << rHL << std::endl;
-  // rHL = receiver
-  emit_load(RegisterValue(rDE), LabelValue(label_ref(dispatch_end)), os); // push return address
-  emit_push(rDE, os);
+    os << EX << rDE << "," << rHL << std::endl;
+    // rHL = receiver
+    emit_load(RegisterValue(rDE), LabelValue(label_ref(dispatch_end)), os); // push return address
+    emit_push(rDE, os);
   
-  emit_push(rBC, os);
-  emit_return(Flags::none, os);     // jp (bc)
+    emit_push(rBC, os);
+    emit_return(Flags::none, os);     // jp (bc)
+  }
   
   emit_label_def(dispatch_abort, os); // if receiver is NULL
 	emit_load(RegisterValue(rDE), Immediate16(static_cast<uint16_t>(this->loc())), os);
@@ -1459,7 +2413,7 @@ void Dispatch::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   
   emit_label_def(dispatch_end, os);
   // pop off params
-  for (Expression *expr : *actuals_) {
+  for (int i = 0; i < (call.callee_pops ? 0 : call.stack); ++i) {
   	emit_pop(rDE, os);
   }
 }
@@ -1469,15 +2423,35 @@ void Assign::CodeGen(VariableEnvironment& varEnv, std::ostream& os) {
   const MemoryLocation& loc = varEnv.Lookup(name_);
   value_->CodeGen(varEnv, os);
   emit_load(MemoryValue(loc), ARG0, os);
+  varEnv.SetAcc(name_, os);
 }
 
 
    void Cgen(Program* program, std::ostream& os, const char *asm_path, const char *lib_path) {
       InitCoolSymbols();
+
+      if (cgen_profile_generate || cgen_profile_use != nullptr) {
+         gCgenProfile.NumberSites(program);
+      }
+      CgenRunPasses(program, true);
       
       CgenKlassTable klass_table(program->klasses());
       gCgenKlassTable = &klass_table;
+      if (cgen_profile_generate || cgen_profile_use != nullptr) {
+         gCgenProfile.Layout(klass_table);
+         if (cgen_profile_use != nullptr && CgenPassEnabled(PASS_PROFILE)) {
+            gCgenProfile.Load(cgen_profile_use);
+         }
+      }
+
+      CgenRunPasses(program, false);
+
+      const auto start = std::chrono::steady_clock::now();
       klass_table.CodeGen(os, asm_path, lib_path);
+      if (cgen_report) {
+         const std::chrono::duration<double,std::milli> codegen = std::chrono::steady_clock::now() - start;
+         CgenReportPasses(std::clog, codegen.count());
+      }
    }
 
 
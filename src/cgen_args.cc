@@ -0,0 +1,43 @@
+/* cgen_args.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * register arguments (pass reg-args): a call passes its last argument in DE
+ * and the one before it in BC, next to the receiver in HL, and pushes any
+ * others; the callee pops those itself. A caller only pushes the register
+ * arguments when evaluating what follows them could change DE or BC (see
+ * Dispatch::CodeGenActuals), and a callee only pushes them, below the saved
+ * frame pointer, if its body reads them (see Method::CodeGen).
+ *
+ * The methods of Object, IO and String are routines of the runtime library,
+ * which take every argument on the stack and leave it for the caller to pop;
+ * so do the methods of any class with the same names, which may override them.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *IO, *Object, *String;
+extern CgenKlassTable* gCgenKlassTable;
+
+CallConvention CgenCallConvention(Symbol* name, int count) {
+	CallConvention call;
+	call.stack = count;
+	if (!CgenPassEnabled(PASS_REG_ARGS)) {
+		return call;
+	}
+	for (Symbol* basic : { Object, IO, String }) {
+		Klass* klass = gCgenKlassTable->ClassFind(basic)->klass();
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			if ((*feature)->method() && (*feature)->name() == name) {
+				return call;
+			}
+		}
+	}
+	call.registers = std::min(count, 2);
+	call.stack = count - call.registers;
+	call.callee_pops = (call.stack > 0);
+	return call;
+}
+
+} // namespace cool
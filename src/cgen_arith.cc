@@ -0,0 +1,234 @@
+/* cgen_arith.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * strength reduction (pass strength): Int multiplication and division by a
+ * constant are done inline instead of calling _MUL_HL_DE or _DIV_HL_DE.
+ * Multiplication becomes a chain of shifts and adds; division truncates
+ * toward zero like _DIV_HL_DE, by shifting for powers of two and otherwise
+ * by multiplying the magnitude by a reciprocal and keeping the high word.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern int label_counter;
+extern CgenKlassTable* gCgenKlassTable;
+extern Symbol *Int;
+
+namespace {
+
+uint32_t Magnitude(int16_t value) {
+	return value < 0 ? -int32_t(value) : value;
+}
+
+bool PowerOfTwo(uint32_t value) {
+	return (value & (value - 1)) == 0;
+}
+
+// HL = -HL
+void EmitNegate(std::ostream& os) {
+	emit_neg(rHL, os);
+}
+
+// HL = HL >> count, unsigned
+void EmitShiftRight(int count, std::ostream& os) {
+	if (count >= 8) {
+		emit_load(rL, rH, os);
+		os << LD << rH << ",0" << std::endl;
+		count -= 8;
+	}
+	for (; count > 0; --count) {
+		os << SRL << rH << std::endl;
+		os << RR << rL << std::endl;
+	}
+}
+
+// HL = HL * value, for value > 0 (mod 2^16)
+void EmitMultiply(uint32_t value, std::ostream& os) {
+	int zeros = 0;
+	for (; (value & 1) == 0; value >>= 1) {
+		++zeros;
+	}
+	if (value > 1) {
+		emit_load(rD, rH, os);
+		emit_load(rE, rL, os);
+		int bit = 31;
+		while (!(value & (1u << bit))) {
+			--bit;
+		}
+		for (--bit; bit >= 0; --bit) {
+			emit_add(rHL, rHL, os);
+			if (value & (1u << bit)) {
+				emit_add(rHL, rDE, os);
+			}
+		}
+	}
+	for (; zeros > 0; --zeros) {
+		emit_add(rHL, rHL, os);
+	}
+}
+
+// finds multiplier and shift with n / divisor == (n * multiplier) >> (16 + shift) for
+// all magnitudes n of Ints (0..32768), with multiplier < 2^16
+bool FindReciprocal(uint32_t divisor, uint32_t& multiplier, int& shift) {
+	for (shift = 0; shift <= 16; ++shift) {
+		const uint64_t scale = uint64_t(1) << (16 + shift);
+		multiplier = (scale + divisor - 1) / divisor;
+		if (multiplier >= 0x10000) {
+			return false;
+		}
+		bool exact = true;
+		for (uint64_t n = 0; exact && n <= 0x8000; ++n) {
+			exact = ((n * multiplier) >> (16 + shift)) == n / divisor;
+		}
+		if (exact) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// HL = (HL * multiplier) >> (16 + shift), for HL <= 32768: the high word of the product is
+// accumulated from the multiplier's low bit up, shifting out the bits below it as it goes
+void EmitReciprocal(uint32_t multiplier, int shift, std::ostream& os) {
+	int steps = 16 + shift;
+	for (; (multiplier & 1) == 0; multiplier >>= 1) {
+		--steps;
+	}
+	os << EX << rDE << "," << rHL << std::endl;
+	emit_load(rH, rD, os); // lowest set bit: accumulator = DE
+	emit_load(rL, rE, os);
+	os << SRL << rH << std::endl;
+	os << RR << rL << std::endl;
+	--steps;
+	for (multiplier >>= 1; multiplier != 0; multiplier >>= 1, --steps) {
+		if (multiplier & 1) {
+			emit_add(rHL, rDE, os); // carry is the 17th bit
+			os << RR << rH << std::endl;
+		} else {
+			os << SRL << rH << std::endl;
+		}
+		os << RR << rL << std::endl;
+	}
+	EmitShiftRight(steps, os);
+}
+
+// HL = HL * value
+void MultiplyConst(int16_t value, std::ostream& os) {
+	if (value == 0) {
+		os << LD << rHL << ",0" << std::endl;
+		return;
+	}
+	EmitMultiply(Magnitude(value), os);
+	if (value < 0) {
+		EmitNegate(os);
+	}
+}
+
+bool DivisionReducible(int16_t value) {
+	uint32_t multiplier;
+	int shift;
+	return value != 0 && (PowerOfTwo(Magnitude(value)) || FindReciprocal(Magnitude(value), multiplier, shift));
+}
+
+// HL = HL / value, rounded toward zero (see DivisionReducible)
+void DivideConst(int16_t value, std::ostream& os) {
+	const uint32_t divisor = Magnitude(value);
+	const int l_positive = label_counter++;
+	const int l_done = label_counter++;
+	if (PowerOfTwo(divisor)) {
+		// power of two: negative dividends are biased by divisor-1 before the arithmetic shift
+		int count = 0;
+		while ((1u << count) < divisor) {
+			++count;
+		}
+		if (count > 0) {
+			os << BIT << "7," << rH << std::endl;
+			emit_jr(l_positive, Flags::Z, os);
+			emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(divisor - 1)), os);
+			emit_add(rHL, rDE, os);
+			emit_label_def(l_positive, os);
+			for (; count > 0; --count) {
+				os << SRA << rH << std::endl;
+				os << RR << rL << std::endl;
+			}
+		}
+		if (value < 0) {
+			EmitNegate(os);
+		}
+		return;
+	}
+
+	uint32_t multiplier;
+	int shift;
+	FindReciprocal(divisor, multiplier, shift);
+	// B keeps the dividend's sign while its magnitude is divided
+	emit_load(rB, rH, os);
+	os << BIT << "7," << rH << std::endl;
+	emit_jr(l_positive, Flags::Z, os);
+	EmitNegate(os);
+	emit_label_def(l_positive, os);
+	EmitReciprocal(multiplier, shift, os);
+	os << BIT << "7," << rB << std::endl;
+	emit_jr(l_done, value < 0 ? Flags::NZ : Flags::Z, os);
+	EmitNegate(os);
+	emit_label_def(l_done, os);
+}
+
+}
+
+// Multiplication or division by an IntLiteral: evaluates only the other operand
+bool BinaryOperator::CodeGenReduced(VariableEnvironment& varEnv, std::ostream& os) {
+	IntLiteral* lhs_int = dynamic_cast<IntLiteral*>(lhs_);
+	IntLiteral* rhs_int = dynamic_cast<IntLiteral*>(rhs_);
+	Expression* operand;
+	int16_t value;
+	if (kind_ == BO_Mul && (lhs_int != nullptr || rhs_int != nullptr)) {
+		operand = (rhs_int != nullptr ? lhs_ : rhs_);
+		value = (rhs_int != nullptr ? rhs_int : lhs_int)->value();
+	} else if (kind_ == BO_Div && rhs_int != nullptr && DivisionReducible(rhs_int->value())) {
+		operand = lhs_;
+		value = rhs_int->value();
+	} else {
+		return false;
+	}
+
+	const bool late_boxing = gCgenKlassTable->LateBoxing();
+	if (!late_boxing) {
+		emit_load(RegisterValue(ARG0), LabelValue(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX)), os);
+		gCgenKlassTable->EmitCopy(Int, os);
+		emit_push(ARG0, os);
+	}
+
+	operand->CodeGen(varEnv, os);
+	// HL = int value (HL needn't be preserved, unlike with emit_fetch_int)
+	if (cgen_tagged) {
+		gCgenKlassTable->EmitUnboxInt(os);
+	} else {
+		emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(DEFAULT_OBJFIELDS * WORD_SIZE)), os);
+		emit_add(rHL, rDE, os);
+		os << LD << rA << ",(" << rHL << ")" << std::endl;
+		emit_inc(rHL, os);
+		os << LD << rH << ",(" << rHL << ")" << std::endl;
+		emit_load(rL, rA, os);
+	}
+
+	if (kind_ == BO_Mul) {
+		MultiplyConst(value, os);
+	} else {
+		DivideConst(value, os);
+	}
+	++gCgenStats.reduced;
+
+	os << EX << rDE << "," << rHL << std::endl;
+	if (late_boxing) {
+		gCgenKlassTable->EmitBoxInt(os);
+	} else {
+		emit_pop(ARG0, os); // pop off copied prototype int obj
+		emit_store_int(rDE, RegisterPointer(ARG0), os);
+	}
+	return true;
+}
+
+} // namespace cool
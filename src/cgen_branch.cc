@@ -0,0 +1,329 @@
+/* cgen_branch.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * branch relaxation: code generation picks jr or jp for a branch without
+ * knowing how far away its target will be, so the generated code is buffered
+ * and every jr/jp to a label in it is given the shortest form that reaches
+ * its target. Instruction sizes are exact; branches start out as jr and
+ * those that can't reach become jp, until no more do. Without pass relax only jr
+ * branches out of range are changed (see CgenRelaxBranches).
+ */
+
+#include <sstream>
+#include <unordered_map>
+#include "cgen.h"
+
+namespace cool {
+
+namespace {
+
+// size of anything relaxation doesn't know, so that no jr reaches across it
+const int kUnknownSize = 0x100;
+
+enum OperandKind { OP_REG8, OP_REG16, OP_INDIRECT, OP_INDEXED, OP_MEMORY, OP_IMMEDIATE };
+
+struct Operand {
+	OperandKind kind;
+	std::string text;
+	bool index = false;  // uses IX or IY (DD/FD prefix)
+};
+
+std::string Trim(const std::string& s) {
+	const auto begin = s.find_first_not_of(" \t");
+	if (begin == std::string::npos) {
+		return "";
+	}
+	return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+// line without its comment (';' outside of string and character literals)
+std::string StripComment(const std::string& line) {
+	char quote = 0;
+	for (std::size_t i = 0; i < line.size(); ++i) {
+		const char c = line[i];
+		if (quote != 0) {
+			if (c == '\\') {
+				++i;
+			} else if (c == quote) {
+				quote = 0;
+			}
+		} else if (c == '"') {
+			quote = c;
+		} else if (c == ';') {
+			return line.substr(0, i);
+		}
+	}
+	return line;
+}
+
+// operands separated by commas outside of literals and parentheses
+std::vector<std::string> SplitOperands(const std::string& s) {
+	std::vector<std::string> operands;
+	std::string current;
+	char quote = 0;
+	int depth = 0;
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		const char c = s[i];
+		if (quote != 0) {
+			current += c;
+			if (c == '\\' && i + 1 < s.size()) {
+				current += s[++i];
+			} else if (c == quote) {
+				quote = 0;
+			}
+			continue;
+		}
+		if (c == '"') {
+			quote = c;
+		} else if (c == '(') {
+			++depth;
+		} else if (c == ')') {
+			--depth;
+		} else if (c == ',' && depth == 0) {
+			operands.push_back(Trim(current));
+			current.clear();
+			continue;
+		}
+		current += c;
+	}
+	if (!Trim(current).empty() || !operands.empty()) {
+		operands.push_back(Trim(current));
+	}
+	return operands;
+}
+
+Operand Classify(const std::string& text) {
+	static const std::set<std::string> reg8 = { "a", "b", "c", "d", "e", "h", "l", "i", "r",
+	                                           "ixh", "ixl", "iyh", "iyl" };
+	static const std::set<std::string> reg16 = { "af", "af'", "bc", "de", "hl", "sp", "ix", "iy" };
+	Operand op;
+	op.text = text;
+	if (reg8.count(text) != 0) {
+		op.kind = OP_REG8;
+		op.index = (text.size() == 3);
+	} else if (reg16.count(text) != 0) {
+		op.kind = OP_REG16;
+		op.index = (text == "ix" || text == "iy");
+	} else if (text.size() > 2 && text.front() == '(' && text.back() == ')') {
+		const std::string inner = Trim(text.substr(1, text.size() - 2));
+		if (inner == "hl" || inner == "bc" || inner == "de" || inner == "sp" || inner == "c") {
+			op.kind = OP_INDIRECT;
+		} else if (inner.compare(0, 2, "ix") == 0 || inner.compare(0, 2, "iy") == 0) {
+			op.kind = OP_INDEXED; // (ix) is (ix+0), except in jp (ix)
+			op.index = true;
+		} else {
+			op.kind = OP_MEMORY;
+		}
+	} else {
+		op.kind = OP_IMMEDIATE;
+	}
+	return op;
+}
+
+// bytes of a .db directive's operands: one per character of a string, one per expression
+int DataBytes(const std::vector<std::string>& operands) {
+	int bytes = 0;
+	for (const std::string& op : operands) {
+		if (op.size() >= 2 && op.front() == '"' && op.back() == '"') {
+			for (std::size_t i = 1; i + 1 < op.size(); ++i, ++bytes) {
+				if (op[i] == '\\') {
+					++i;
+				}
+			}
+		} else {
+			++bytes;
+		}
+	}
+	return bytes;
+}
+
+// encoded size of an instruction or directive, in bytes
+int InstructionSize(const std::string& mnemonic, const std::vector<std::string>& operand_text) {
+	std::vector<Operand> ops;
+	bool index = false;
+	bool indexed = false;
+	for (const std::string& text : operand_text) {
+		ops.push_back(Classify(text));
+		index |= ops.back().index;
+		indexed |= (ops.back().kind == OP_INDEXED);
+	}
+	const int prefix = index ? 1 : 0;
+
+	if (mnemonic == ".dw") {
+		return 2 * ops.size();
+	} else if (mnemonic == ".db") {
+		return DataBytes(operand_text);
+	} else if (mnemonic == "bcall") {
+		return 3; // rst 28h \ .dw addr
+	} else if (mnemonic == "bjump") {
+		return 5; // call 50h \ .dw addr
+	}
+
+	static const std::set<std::string> implied = { "nop", "halt", "di", "ei", "exx", "scf", "ccf", "cpl",
+	                                              "daa", "rla", "rra", "rlca", "rrca", "rst" };
+	static const std::set<std::string> extended = { "neg", "ldi", "ldd", "ldir", "lddr", "cpi", "cpd",
+	                                               "cpir", "cpdr", "reti", "retn", "im", "in", "out",
+	                                               "rld", "rrd" };
+	static const std::set<std::string> alu = { "add", "adc", "sbc", "sub", "and", "or", "xor", "cp" };
+	static const std::set<std::string> rotate = { "rl", "rr", "rlc", "rrc", "sla", "sra", "srl", "sll",
+	                                             "bit", "set", "res" };
+	if (implied.count(mnemonic) != 0 || mnemonic == "ret") {
+		return 1;
+	} else if (extended.count(mnemonic) != 0) {
+		return 2;
+	} else if (mnemonic == "push" || mnemonic == "pop" || mnemonic == "ex") {
+		return 1 + prefix;
+	} else if (mnemonic == "jr" || mnemonic == "djnz") {
+		return 2;
+	} else if (mnemonic == "call") {
+		return 3;
+	} else if (mnemonic == "jp") {
+		return (ops.back().kind != OP_IMMEDIATE) ? 1 + prefix : 3;
+	} else if (mnemonic == "inc" || mnemonic == "dec") {
+		return indexed ? 3 : 1 + prefix;
+	} else if (rotate.count(mnemonic) != 0) {
+		return indexed ? 4 : 2;
+	} else if (alu.count(mnemonic) != 0 && !ops.empty()) {
+		if (ops.size() == 2 && ops[0].kind == OP_REG16) {
+			return (mnemonic == "add") ? 1 + prefix : 2;
+		}
+		switch (ops.back().kind) {
+		case OP_IMMEDIATE: return 2;
+		case OP_INDEXED:   return 3;
+		default:           return 1 + prefix;
+		}
+	} else if (mnemonic == "ld" && ops.size() == 2) {
+		const Operand& dst = ops[0];
+		const Operand& src = ops[1];
+		if (dst.text == "i" || dst.text == "r" || src.text == "i" || src.text == "r") {
+			return 2;
+		} else if (dst.kind == OP_REG16 && src.kind == OP_IMMEDIATE) {
+			return 3 + prefix;
+		} else if (dst.kind == OP_MEMORY || src.kind == OP_MEMORY) {
+			const Operand& reg = (dst.kind == OP_MEMORY) ? src : dst;
+			if (reg.kind == OP_REG16) {
+				return (reg.text == "hl") ? 3 : 4; // ld bc/de/sp,(nn) are ED-prefixed
+			}
+			return 3;
+		} else if (indexed) {
+			return (src.kind == OP_IMMEDIATE) ? 4 : 3;
+		} else if (src.kind == OP_IMMEDIATE) {
+			return 2 + prefix;
+		} else {
+			return 1 + prefix;
+		}
+	}
+	return kUnknownSize;
+}
+
+// a line of the buffered code
+struct Line {
+	std::string text;
+	std::string label;          // label defined by this line, if any
+	int size = 0;               // bytes
+	std::string target;         // label branched to by a relaxable jr/jp
+	bool jump = false;          // relaxable branch currently encoded as jp
+	std::size_t operands = 0;   // offset of the branch's operands in text
+};
+
+void ParseLine(Line& line) {
+	const std::string code = Trim(StripComment(line.text));
+	if (code.empty()) {
+		return;
+	} else if (code[0] == '#') {
+		line.size = (code.compare(0, 8, "#include") == 0) ? kUnknownSize : 0;
+		return;
+	}
+	const auto space = code.find_first_of(" \t");
+	const std::string mnemonic = code.substr(0, space);
+	if (space == std::string::npos && mnemonic.back() == ':') {
+		line.label = mnemonic.substr(0, mnemonic.size() - 1);
+		return;
+	}
+	const std::vector<std::string> operands =
+		SplitOperands(space == std::string::npos ? "" : code.substr(space + 1));
+	line.size = InstructionSize(mnemonic, operands);
+
+	// only the conditions jr has
+	if ((mnemonic == "jr" || mnemonic == "jp")
+		&& (operands.size() == 1 || (operands.size() == 2 && (operands[0] == "z" || operands[0] == "nz"
+		                                                      || operands[0] == "c" || operands[0] == "nc")))
+		&& Classify(operands.back()).kind == OP_IMMEDIATE) {
+		line.target = operands.back();
+		line.jump = (mnemonic == "jp");
+		line.operands = line.text.find(mnemonic) + mnemonic.size();
+	}
+}
+
+}
+
+std::string CgenRelaxBranches(const std::string& code, bool shorten) {
+	std::vector<Line> lines;
+	std::istringstream is(code);
+	for (std::string text; std::getline(is, text); ) {
+		Line line;
+		line.text = text;
+		ParseLine(line);
+		lines.push_back(line);
+	}
+
+	std::unordered_map<std::string,std::size_t> labels;
+	for (std::size_t i = 0; i < lines.size(); ++i) {
+		if (!lines[i].label.empty()) {
+			labels[lines[i].label] = i;
+		}
+	}
+
+	std::vector<Line*> branches;
+	std::vector<bool> was_jump;
+	for (Line& line : lines) {
+		if (!line.target.empty() && labels.count(line.target) != 0) {
+			branches.push_back(&line);
+			was_jump.push_back(line.jump);
+			line.jump = (line.jump && !shorten);
+			line.size = line.jump ? 3 : 2;
+		} else {
+			line.target.clear();
+		}
+	}
+
+	// branches only ever grow, so this ends
+	std::vector<int> address(lines.size() + 1);
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (std::size_t i = 0; i < lines.size(); ++i) {
+			address[i + 1] = address[i] + lines[i].size;
+		}
+		for (std::size_t i = 0; i < lines.size(); ++i) {
+			Line& line = lines[i];
+			if (line.target.empty() || line.jump) {
+				continue;
+			}
+			const int offset = address[labels[line.target]] - address[i + 1];
+			if (offset < -128 || offset > 127) {
+				line.jump = true;
+				line.size = 3;
+				changed = true;
+			}
+		}
+	}
+
+	std::ostringstream os;
+	for (std::size_t i = 0, b = 0; i < lines.size(); ++i) {
+		const Line& line = lines[i];
+		if (line.target.empty()) {
+			os << line.text << std::endl;
+			continue;
+		}
+		os << (line.jump ? JP : JR) << Trim(line.text.substr(line.operands)) << std::endl;
+		if (was_jump[b] && !line.jump) {
+			++gCgenStats.shortened_branches;
+		} else if (!was_jump[b] && line.jump) {
+			++gCgenStats.lengthened_branches;
+		}
+		++b;
+	}
+	return os.str();
+}
+
+} // namespace cool
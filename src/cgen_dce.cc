@@ -0,0 +1,254 @@
+/* cgen_dce.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * dead value and dead store elimination (pass dce): of a computation
+ * whose value is thrown away (a statement of a block other than the last, or
+ * the body of a loop) only the parts with side effects are kept. A store to a
+ * local variable, by an assignment or a let's initializer, is left out if the
+ * variable is always assigned again before it's read.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+
+namespace {
+
+typedef std::vector<Symbol*> Scope; // local variables (let, case and formals), innermost last
+
+// How a piece of code uses a variable, as seen from its start
+struct Access {
+	bool may_read = false;    // some path reads the variable before assigning it
+	bool must_write = false;  // every path assigns it (before or without reading it)
+};
+
+// a, then b
+Access Then(const Access& a, const Access& b) {
+	Access both;
+	both.may_read = a.may_read || (!a.must_write && b.may_read);
+	both.must_write = a.must_write || b.must_write;
+	return both;
+}
+
+// a or b
+Access Either(const Access& a, const Access& b) {
+	Access either;
+	either.may_read = a.may_read || b.may_read;
+	either.must_write = a.must_write && b.must_write;
+	return either;
+}
+
+std::vector<Expression*> Children(Expression* expr) {
+	std::vector<Expression*> children;
+	expr->ForEachChild([&](Expression* child) { children.push_back(child); });
+	return children;
+}
+
+// children are evaluated in ForEachChild order, which is also code generation order
+Access Uses(Expression* expr, Symbol* var) {
+	const std::vector<Expression*> children = Children(expr);
+	Access access;
+	if (Ref* ref = dynamic_cast<Ref*>(expr)) {
+		access.may_read = (ref->name() == var);
+	} else if (Assign* assign = dynamic_cast<Assign*>(expr)) {
+		Access write;
+		write.must_write = (assign->name() == var);
+		access = Then(Uses(children[0], var), write);
+	} else if (dynamic_cast<Cond*>(expr) != nullptr) {
+		access = Then(Uses(children[0], var), Either(Uses(children[1], var), Uses(children[2], var)));
+	} else if (dynamic_cast<Loop*>(expr) != nullptr) {
+		// the body may run any number of times
+		access = Uses(children[0], var);
+		access.may_read |= Uses(children[1], var).may_read;
+	} else if (Let* let = dynamic_cast<Let*>(expr)) {
+		access = Uses(children[0], var);
+		if (let->name() != var) {
+			access = Then(access, Uses(children[1], var));
+		}
+	} else if (dynamic_cast<Kase*>(expr) != nullptr) {
+		Access branches = Uses(children[1], var);
+		for (std::size_t i = 2; i < children.size(); ++i) {
+			branches = Either(branches, Uses(children[i], var));
+		}
+		access = Then(Uses(children[0], var), branches);
+	} else if (KaseBranch* branch = dynamic_cast<KaseBranch*>(expr)) {
+		if (branch->name() != var) {
+			access = Uses(children[0], var);
+		}
+	} else {
+		for (Expression* child : children) {
+			access = Then(access, Uses(child, var));
+		}
+	}
+	return access;
+}
+
+// var is assigned again before it's read, from the start of exprs[begin]
+bool Overwritten(const std::vector<Expression*>& exprs, std::size_t begin, Symbol* var) {
+	Access access;
+	for (std::size_t i = begin; i < exprs.size(); ++i) {
+		access = Then(access, Uses(exprs[i], var));
+	}
+	return access.must_write && !access.may_read;
+}
+
+// a block of exprs, or the only one
+Expression* Sequence(const std::vector<Expression*>& exprs, SourceLoc loc) {
+	if (exprs.size() == 1) {
+		return exprs[0];
+	}
+	Expressions* body = Expressions::Create();
+	for (Expression* expr : exprs) {
+		body->push_back(expr);
+	}
+	Block* block = Block::Create(body, loc);
+	block->set_type(exprs.back()->type());
+	return block;
+}
+
+class DeadCode {
+ public:
+	DeadCode(Klass* klass, Effects& effects) : klass_(klass), effects_(effects) {}
+
+	/// Eliminate dead values & stores in expr and its subexpressions
+	/// \return expression to replace expr with
+	Expression* Eliminate(Expression* expr, Scope& locals);
+
+ private:
+	Klass* klass_;
+	Effects& effects_;
+
+	/// Appends the parts of expr with side effects to kept, in evaluation order
+	/// \return whether any part of expr was left out
+	bool Discard(Expression* expr, std::vector<Expression*>& kept);
+	Expression* EliminateBlock(Block* block, Scope& locals);
+};
+
+bool DeadCode::Discard(Expression* expr, std::vector<Expression*>& kept) {
+	bool calls = false;
+	if (effects_.Pure(expr, klass_, [](Symbol*) { return true; }, calls)) {
+		++gCgenStats.dead_values;
+		return true;
+	}
+
+	BinaryOperator* binop = dynamic_cast<BinaryOperator*>(expr);
+	IntLiteral* divisor = (binop != nullptr) ? dynamic_cast<IntLiteral*>(binop->rhs()) : nullptr;
+	const bool can_fail = (binop != nullptr && binop->kind() == BinaryOperator::BO_Div
+		&& (divisor == nullptr || divisor->value() == 0));
+	if ((binop != nullptr && !can_fail) || dynamic_cast<UnaryOperator*>(expr) != nullptr
+		|| dynamic_cast<Block*>(expr) != nullptr) {
+		// the operation itself can't fail, only its operands can have effects
+		bool dropped = (dynamic_cast<Block*>(expr) == nullptr);
+		if (dropped) {
+			++gCgenStats.dead_values;
+		}
+		expr->ForEachChild([&](Expression* child) { dropped = Discard(child, kept) || dropped; });
+		return dropped;
+	}
+	kept.push_back(expr);
+	return false;
+}
+
+Expression* DeadCode::EliminateBlock(Block* block, Scope& locals) {
+	const std::vector<Expression*> body = Children(block);
+	std::vector<Expression*> kept;
+	bool changed = false;
+	for (std::size_t i = 0; i + 1 < body.size(); ++i) {
+		Assign* assign = dynamic_cast<Assign*>(body[i]);
+		if (assign != nullptr && std::find(locals.begin(), locals.end(), assign->name()) != locals.end()
+			&& Overwritten(body, i + 1, assign->name())) {
+			++gCgenStats.dead_stores;
+			Discard(Children(assign)[0], kept);
+			changed = true;
+		} else {
+			changed = Discard(body[i], kept) || changed;
+		}
+	}
+	if (!changed) {
+		return block;
+	}
+	kept.push_back(body.back());
+	return Sequence(kept, block->loc());
+}
+
+Expression* DeadCode::Eliminate(Expression* expr, Scope& locals) {
+	Let* let = dynamic_cast<Let*>(expr);
+	KaseBranch* branch = dynamic_cast<KaseBranch*>(expr);
+	int index = 0;
+	expr->MapChildren([&](Expression* child) {
+		// a let's variable is in scope in its body, a branch's in all of the branch
+		const bool bound = (let != nullptr && index++ == 1) || branch != nullptr;
+		if (bound) {
+			locals.push_back(let != nullptr ? let->name() : branch->name());
+		}
+		Expression* result = Eliminate(child, locals);
+		if (bound) {
+			locals.pop_back();
+		}
+		return result;
+	});
+
+	if (Block* block = dynamic_cast<Block*>(expr)) {
+		return EliminateBlock(block, locals);
+	} else if (dynamic_cast<Loop*>(expr) != nullptr) {
+		// a loop's value is void, whatever its body's
+		index = 0;
+		expr->MapChildren([&](Expression* child) {
+			if (index++ == 0) {
+				return child;
+			}
+			std::vector<Expression*> kept;
+			if (!Discard(child, kept)) {
+				return child;
+			}
+			return kept.empty() ? (Expression*) NoExpr::Create(child->loc()) : Sequence(kept, child->loc());
+		});
+	} else if (let != nullptr) {
+		Access access = Uses(let->body(), let->name());
+		if (access.must_write && !access.may_read) {
+			++gCgenStats.dead_stores;
+			let->set_init_dead();
+			if (dynamic_cast<NoExpr*>(let->init()) == nullptr) {
+				std::vector<Expression*> kept;
+				Discard(let->init(), kept);
+				index = 0;
+				let->MapChildren([&](Expression* child) {
+					if (index++ != 0) {
+						return child;
+					}
+					return kept.empty() ? (Expression*) NoExpr::Create(child->loc()) : Sequence(kept, child->loc());
+				});
+			}
+		}
+	}
+	return expr;
+}
+
+}
+
+void CgenEliminateDead(Program* program) {
+	Effects effects;
+	for (Klass* klass : *program->klasses()) {
+		if (gCgenKlassTable->ClassFind(klass->name())->basic()) {
+			continue;
+		}
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			DeadCode dead(klass, effects);
+			Scope locals;
+			if ((*feature)->method()) {
+				Method* method = (Method*) *feature;
+				for (auto formal = method->formals_begin(); formal != method->formals_end(); ++formal) {
+					locals.push_back((*formal)->name());
+				}
+				method->set_body(dead.Eliminate(method->body(), locals));
+			} else {
+				Attr* attr = (Attr*) *feature;
+				attr->set_init(dead.Eliminate(attr->init(), locals));
+			}
+		}
+	}
+}
+
+} // namespace cool
@@ -0,0 +1,179 @@
+/* cgen_disptab.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * dispatch table compaction: after devirtualization, only the selectors of
+ * the remaining dynamic dispatches need table entries. Each such selector
+ * gets a color (its index in every table) distinct from the colors of all
+ * selectors it shares a class with; the resulting rows are then overlapped
+ * in a single table wherever their entries don't conflict. Entries are
+ * 2 bytes (.dw method), since the whole program is on one flash page.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *SELF_TYPE;
+
+namespace {
+
+// dynamic dispatches that go through a table, as (static type, selector)
+void FindTableSites(Expression* expr, Klass* klass, std::set<std::pair<Symbol*,Symbol*>>& sites) {
+	expr->ForEachChild([&](Expression* child) { FindTableSites(child, klass, sites); });
+
+	Dispatch* dispatch = dynamic_cast<Dispatch*>(expr);
+	if (dispatch == nullptr || dynamic_cast<StaticDispatch*>(dispatch) != nullptr
+		|| dispatch->DirectTarget(klass) != nullptr) {
+		return;
+	}
+	Symbol* type = dispatch->receiver()->type();
+	sites.emplace(type == SELF_TYPE ? klass->name() : type, dispatch->name());
+}
+
+bool SameEntry(const DispatchEntry* lhs, const DispatchEntry* rhs) {
+	return lhs->klass_ == rhs->klass_ && lhs->method_ == rhs->method_;
+}
+
+}
+
+void CgenKlassTable::CompactDispatchTables(Program* program) {
+	compact_ = true;
+
+	// 1. table sites in reachable code
+	std::set<std::pair<Symbol*,Symbol*>> sites;
+	for (CgenNode* node : nodes_) {
+		Klass* klass = node->klass();
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			if ((*feature)->method()) {
+				Method* method = (Method*) *feature;
+				if (!node->basic() && node->Reachable(method->name())) {
+					FindTableSites(method->body(), klass, sites);
+				}
+			} else if (node->initialized_) {
+				FindTableSites(((Attr*) *feature)->init(), klass, sites);
+			}
+		}
+	}
+
+	// 2. selectors each instantiated class needs an entry for
+	std::map<Symbol*,std::vector<CgenNode*>> classes; // selector -> classes
+	for (CgenNode* node : nodes_) {
+		if (!node->instantiated_) {
+			continue;
+		}
+		gCgenStats.disptab_bytes += node->dispTab_.size() * (WORD_SIZE + BYTE_SIZE);
+		for (const auto& site : sites) {
+			CgenNode* type = ClassFind(site.first);
+			const CgenNode* ancestor = node;
+			while (ancestor != nullptr && ancestor != type) {
+				ancestor = ancestor->parent();
+			}
+			if (ancestor != nullptr
+				&& (classes[site.second].empty() || classes[site.second].back() != node)) {
+				classes[site.second].push_back(node);
+			}
+		}
+	}
+
+	// 3. color selectors, most widely understood first
+	std::vector<Symbol*> selectors;
+	for (const auto& p : classes) {
+		selectors.push_back(p.first);
+	}
+	std::stable_sort(selectors.begin(), selectors.end(), [&](Symbol* lhs, Symbol* rhs) {
+		return classes[lhs].size() > classes[rhs].size();
+	});
+	for (Symbol* selector : selectors) {
+		std::set<int> taken;
+		for (CgenNode* node : classes[selector]) {
+			for (std::size_t color = 0; color < node->row_.size(); ++color) {
+				if (node->row_[color] != nullptr) {
+					taken.insert(color);
+				}
+			}
+		}
+		int color = 0;
+		while (taken.count(color)) {
+			++color;
+		}
+		selector_color_[selector] = color;
+		for (CgenNode* node : classes[selector]) {
+			if ((int) node->row_.size() <= color) {
+				node->row_.resize(color + 1, nullptr);
+			}
+			node->row_[color] = &node->dispTab_[selector];
+		}
+	}
+
+	// 4. row displacement: place each row (longest first) at the first offset where
+	//    its entries only meet holes or identical entries
+	std::vector<CgenNode*> rows;
+	for (CgenNode* node : nodes_) {
+		if (node->instantiated_) {
+			rows.push_back(node);
+		}
+	}
+	std::stable_sort(rows.begin(), rows.end(), [](const CgenNode* lhs, const CgenNode* rhs) {
+		return lhs->row_.size() > rhs->row_.size();
+	});
+	for (CgenNode* node : rows) {
+		const std::vector<const DispatchEntry*>& row = node->row_;
+		std::size_t offset = 0;
+		for (;; ++offset) {
+			bool fits = true;
+			for (std::size_t i = 0; fits && i < row.size() && offset + i < compact_table_.size(); ++i) {
+				const DispatchEntry* entry = compact_table_[offset + i];
+				fits = (row[i] == nullptr || entry == nullptr || SameEntry(row[i], entry));
+			}
+			if (fits) {
+				break;
+			}
+		}
+		if (compact_table_.size() < offset + row.size()) {
+			compact_table_.resize(offset + row.size(), nullptr);
+		}
+		for (std::size_t i = 0; i < row.size(); ++i) {
+			if (row[i] != nullptr) {
+				compact_table_[offset + i] = row[i];
+			}
+		}
+		node->row_offset_ = offset;
+	}
+
+	gCgenStats.compact_bytes = compact_table_.size() * WORD_SIZE;
+}
+
+int16_t CgenKlassTable::DispatchOffset(Symbol* klass, Symbol* method) {
+	if (compact_) {
+		return selector_color_.at(method) * WORD_SIZE;
+	}
+	return ClassFind(klass)->dispTab()[method].loc_.offset();
+}
+
+// CgenCompactDispatchTables: emits the shared table, with each class's label at its row
+void CgenKlassTable::CgenCompactDispatchTables(std::ostream& os) const {
+	std::multimap<int,Symbol*> labels;
+	for (CgenNode* node : nodes_) {
+		if (node->instantiated_) {
+			labels.emplace(node->row_offset_, node->klass()->name());
+		}
+	}
+
+	auto label = labels.begin();
+	for (std::size_t i = 0; i <= compact_table_.size(); ++i) {
+		for (; label != labels.end() && label->first == (int) i; ++label) {
+			os << label->second << DISPTAB_SUFFIX << LABEL;
+		}
+		if (i == compact_table_.size()) {
+			break;
+		}
+		const DispatchEntry* entry = compact_table_[i];
+		if (entry == nullptr) {
+			os << DW << 0 << std::endl;
+		} else {
+			os << DW << entry->klass_->value() << METHOD_SEP << entry->method_->value() << std::endl;
+		}
+	}
+}
+
+} // namespace cool
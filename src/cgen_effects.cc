@@ -0,0 +1,172 @@
+/* cgen_effects.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * effect analysis for the passes that move or share computations
+ * (cgen_licm.cc, cgen_lvn.cc): which expressions have no side effects and
+ * can't fail, and which variables and attributes a piece of code may change
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+extern Symbol *Bool, *concat, *Int, *length, *Object, *self, *SELF_TYPE, *String, *type_name;
+
+namespace {
+
+// builtin methods (implemented in assembly) that have no side effects and can't fail
+bool PureBuiltin(const Symbol* klass, Symbol* method) {
+	return (klass == String && (method == length || method == concat))
+		|| (klass == Object && method == type_name);
+}
+
+// a receiver that can't be void: self, or a value of a basic type
+bool NeverVoid(Expression* expr) {
+	Ref* ref = dynamic_cast<Ref*>(expr);
+	return (ref != nullptr && ref->name() == self)
+		|| expr->type() == Int || expr->type() == Bool || expr->type() == String;
+}
+
+// variables assigned or bound in expr; bound ones count as changed, since a
+// variable bound in a loop has a different value in every iteration
+void FindChanged(Expression* expr, std::set<Symbol*>& changed) {
+	expr->ForEachChild([&](Expression* child) { FindChanged(child, changed); });
+
+	if (Assign* assign = dynamic_cast<Assign*>(expr)) {
+		changed.insert(assign->name());
+	} else if (Let* let = dynamic_cast<Let*>(expr)) {
+		changed.insert(let->name());
+	} else if (KaseBranch* branch = dynamic_cast<KaseBranch*>(expr)) {
+		changed.insert(branch->name());
+	}
+}
+
+bool IsAttr(Klass* klass, Symbol* name) {
+	const auto& vars = gCgenKlassTable->ClassFind(klass->name())->attrVarEnv().vars_;
+	auto it = vars.find(name);
+	return it != vars.end() && !it->second.empty();
+}
+
+}
+
+bool Effects::Pure(Expression* expr, Klass* klass, const std::function<bool(Symbol*)>& readable,
+				   bool& calls) {
+	if (dynamic_cast<IntLiteral*>(expr) != nullptr || dynamic_cast<BoolLiteral*>(expr) != nullptr
+		|| dynamic_cast<StringLiteral*>(expr) != nullptr || dynamic_cast<NoExpr*>(expr) != nullptr) {
+		return true;
+	}
+	if (Ref* ref = dynamic_cast<Ref*>(expr)) {
+		return ref->name() == self || readable(ref->name());
+	}
+	if (dynamic_cast<Assign*>(expr) != nullptr || dynamic_cast<Knew*>(expr) != nullptr
+		|| dynamic_cast<Loop*>(expr) != nullptr || dynamic_cast<Kase*>(expr) != nullptr) {
+		return false; // side effects, possibly no termination, or abort on no match
+	}
+
+	bool pure = true;
+	expr->ForEachChild([&](Expression* child) { pure = pure && Pure(child, klass, readable, calls); });
+	if (!pure) {
+		return false;
+	}
+
+	if (BinaryOperator* binop = dynamic_cast<BinaryOperator*>(expr)) {
+		if (binop->kind() == BinaryOperator::BO_Div) {
+			IntLiteral* divisor = dynamic_cast<IntLiteral*>(binop->rhs());
+			return divisor != nullptr && divisor->value() != 0;
+		}
+		return true;
+	}
+	if (Dispatch* dispatch = dynamic_cast<Dispatch*>(expr)) {
+		const Symbol* target = dispatch->DirectTarget(klass);
+		if (target == nullptr || !NeverVoid(dispatch->receiver())) {
+			return false;
+		}
+		CgenNode* node = gCgenKlassTable->ClassFind(const_cast<Symbol*>(target));
+		if (node->basic()) {
+			return PureBuiltin(target, dispatch->name());
+		}
+		calls = true;
+		return PureMethod(node, dispatch->name());
+	}
+	return true; // UnaryOperator, Cond, Block, Let
+}
+
+// recursion is assumed impure, since it may not terminate
+bool Effects::PureMethod(CgenNode* node, Symbol* method) {
+	const auto key = std::make_pair(node, method);
+	auto it = pure_.find(key);
+	if (it != pure_.end()) {
+		return it->second;
+	}
+	pure_[key] = false;
+	bool calls = false;
+	const bool pure = Pure(node->klass()->method(method)->body(), node->klass(),
+						   [](Symbol*) { return true; }, calls);
+	pure_[key] = pure;
+	return pure;
+}
+
+bool Effects::MayWriteAttrs(Expression* expr, Klass* klass) {
+	bool writes = false;
+	expr->ForEachChild([&](Expression* child) { writes = writes || MayWriteAttrs(child, klass); });
+	if (writes) {
+		return true;
+	}
+
+	if (Assign* assign = dynamic_cast<Assign*>(expr)) {
+		return IsAttr(klass, assign->name());
+	}
+	if (Dispatch* dispatch = dynamic_cast<Dispatch*>(expr)) {
+		const Symbol* target = dispatch->DirectTarget(klass);
+		if (target == nullptr) {
+			return true; // any override might
+		}
+		CgenNode* node = gCgenKlassTable->ClassFind(const_cast<Symbol*>(target));
+		return !node->basic() && WritingMethod(node, dispatch->name());
+	}
+	if (Knew* knew = dynamic_cast<Knew*>(expr)) {
+		if (knew->name() == SELF_TYPE) {
+			return true;
+		}
+		// initializers of the new object and its ancestors
+		for (CgenNode* node = gCgenKlassTable->ClassFind(knew->name()); node != nullptr; node = node->parent()) {
+			for (auto feature = node->klass()->features_begin(); feature != node->klass()->features_end(); ++feature) {
+				if ((*feature)->attr() && !((Attr*) *feature)->init()->Pure()) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// recursion is assumed to write
+bool Effects::WritingMethod(CgenNode* node, Symbol* method) {
+	const auto key = std::make_pair(node, method);
+	auto it = writes_.find(key);
+	if (it != writes_.end()) {
+		return it->second;
+	}
+	writes_[key] = true;
+	const bool writes = MayWriteAttrs(node->klass()->method(method)->body(), node->klass());
+	writes_[key] = writes;
+	return writes;
+}
+
+Effects::Region Effects::Scan(Expression* region, Klass* klass) {
+	Region scan;
+	FindChanged(region, scan.changed);
+	scan.writes_attrs = MayWriteAttrs(region, klass);
+	return scan;
+}
+
+bool Effects::Invariant(Expression* expr, const Region& region, Klass* klass) {
+	auto readable = [&](Symbol* name) {
+		return region.changed.count(name) == 0 && !(region.writes_attrs && IsAttr(klass, name));
+	};
+	bool calls = false;
+	return Pure(expr, klass, readable, calls) && !(calls && region.writes_attrs);
+}
+
+} // namespace cool
@@ -0,0 +1,212 @@
+/* cgen_fold.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * constant folding & algebraic simplification of the AST,
+ * run before code generation (pass fold)
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *Int, *Bool;
+
+namespace {
+
+// Int arithmetic wraps around at 16 bits, just like the generated code
+IntLiteral* FoldInt(int32_t value, SourceLoc loc) {
+	IntLiteral* lit = IntLiteral::Create(static_cast<int16_t>(value), loc);
+	lit->set_type(Int);
+	++gCgenStats.folded;
+	return lit;
+}
+
+BoolLiteral* FoldBool(bool value, SourceLoc loc) {
+	BoolLiteral* lit = BoolLiteral::Create(value, loc);
+	lit->set_type(Bool);
+	++gCgenStats.folded;
+	return lit;
+}
+
+// Replacing a node with one of its subexpressions is only safe if the static
+// type doesn't change, since code generation of the parent depends on it
+Expression* FoldTo(Expression* expr, Expression* replacement) {
+	if (replacement->type() != expr->type()) {
+		return expr;
+	}
+	++gCgenStats.folded;
+	return replacement;
+}
+
+bool IsInt(Expression* expr, int32_t value) {
+	IntLiteral* lit = dynamic_cast<IntLiteral*>(expr);
+	return lit != nullptr && lit->value() == value;
+}
+
+}
+
+void CgenFold(Program* program) {
+	for (Klass* klass : *program->klasses()) {
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			(*feature)->Fold();
+		}
+	}
+}
+
+void Method::Fold() {
+	body_ = body_->Fold();
+}
+
+void Attr::Fold() {
+	init_ = init_->Fold();
+}
+
+Expression* Assign::Fold() {
+	value_ = value_->Fold();
+	return this;
+}
+
+Expression* Dispatch::Fold() {
+	receiver_ = receiver_->Fold();
+	for (Expressions::size_type i = 0; i < actuals_->size(); ++i) {
+		actuals_->set(i, actuals_->at(i)->Fold());
+	}
+	return this;
+}
+
+Expression* Cond::Fold() {
+	pred_ = pred_->Fold();
+	then_branch_ = then_branch_->Fold();
+	else_branch_ = else_branch_->Fold();
+
+	// if true/false then ... else ... fi
+	if (BoolLiteral* pred = dynamic_cast<BoolLiteral*>(pred_)) {
+		return FoldTo(this, pred->value() ? then_branch_ : else_branch_);
+	}
+	return this;
+}
+
+Expression* Loop::Fold() {
+	pred_ = pred_->Fold();
+	body_ = body_->Fold();
+	return this;
+}
+
+Expression* Block::Fold() {
+	for (Expressions::size_type i = 0; i < body_->size(); ++i) {
+		body_->set(i, body_->at(i)->Fold());
+	}
+	if (body_->size() == 1) {
+		return FoldTo(this, body_->back());
+	}
+	return this;
+}
+
+Expression* Let::Fold() {
+	init_ = init_->Fold();
+	body_ = body_->Fold();
+	return this;
+}
+
+Expression* Kase::Fold() {
+	input_ = input_->Fold();
+	for (KaseBranch* branch : *cases_) {
+		branch->Fold();
+	}
+	return this;
+}
+
+Expression* KaseBranch::Fold() {
+	body_ = body_->Fold();
+	return this;
+}
+
+Expression* UnaryOperator::Fold() {
+	input_ = input_->Fold();
+
+	switch (kind_) {
+	case UO_Neg:
+		if (IntLiteral* lit = dynamic_cast<IntLiteral*>(input_)) {
+			return FoldInt(-lit->value(), loc());
+		}
+		break;
+	case UO_Not:
+		if (BoolLiteral* lit = dynamic_cast<BoolLiteral*>(input_)) {
+			return FoldBool(!lit->value(), loc());
+		}
+		break;
+	case UO_IsVoid:
+		// literals are never void
+		if (dynamic_cast<IntLiteral*>(input_) || dynamic_cast<BoolLiteral*>(input_)
+			|| dynamic_cast<StringLiteral*>(input_)) {
+			return FoldBool(false, loc());
+		}
+		return this;
+	}
+
+	// ~(~x) = x, not (not x) = x
+	UnaryOperator* inner = dynamic_cast<UnaryOperator*>(input_);
+	if (inner != nullptr && inner->kind_ == kind_) {
+		return FoldTo(this, inner->input_);
+	}
+	return this;
+}
+
+Expression* BinaryOperator::Fold() {
+	lhs_ = lhs_->Fold();
+	rhs_ = rhs_->Fold();
+
+	IntLiteral* lhs_int = dynamic_cast<IntLiteral*>(lhs_);
+	IntLiteral* rhs_int = dynamic_cast<IntLiteral*>(rhs_);
+	if (lhs_int && rhs_int) {
+		int32_t l = lhs_int->value();
+		int32_t r = rhs_int->value();
+		switch (kind_) {
+		case BO_Add: return FoldInt(l + r, loc());
+		case BO_Sub: return FoldInt(l - r, loc());
+		case BO_Mul: return FoldInt(l * r, loc());
+		case BO_Div:
+			if (r == 0) {
+				return this; // leave division by zero to the runtime
+			}
+			return FoldInt(l / r, loc());
+		case BO_LT: return FoldBool(l < r, loc());
+		case BO_LE: return FoldBool(l <= r, loc());
+		case BO_EQ: return FoldBool(l == r, loc());
+		}
+	}
+
+	BoolLiteral* lhs_bool = dynamic_cast<BoolLiteral*>(lhs_);
+	BoolLiteral* rhs_bool = dynamic_cast<BoolLiteral*>(rhs_);
+	if (kind_ == BO_EQ && lhs_bool && rhs_bool) {
+		return FoldBool(lhs_bool->value() == rhs_bool->value(), loc());
+	}
+
+	// algebraic identities
+	switch (kind_) {
+	case BO_Add:
+		if (IsInt(rhs_, 0)) return FoldTo(this, lhs_);
+		if (IsInt(lhs_, 0)) return FoldTo(this, rhs_);
+		break;
+	case BO_Sub:
+		if (IsInt(rhs_, 0)) return FoldTo(this, lhs_);
+		break;
+	case BO_Mul:
+		if (IsInt(rhs_, 1)) return FoldTo(this, lhs_);
+		if (IsInt(lhs_, 1)) return FoldTo(this, rhs_);
+		// x * 0 = 0 only if x can be dropped
+		if ((IsInt(rhs_, 0) && lhs_->Pure()) || (IsInt(lhs_, 0) && rhs_->Pure())) {
+			return FoldInt(0, loc());
+		}
+		break;
+	case BO_Div:
+		if (IsInt(rhs_, 1)) return FoldTo(this, lhs_);
+		break;
+	default:
+		break;
+	}
+
+	return this;
+}
+
+} // namespace cool
@@ -0,0 +1,59 @@
+/* cgen_frame.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * leaf method analysis: Method::CodeGen only sets up a frame pointer for
+ * bodies that have temporaries or read their arguments, and only saves and
+ * rebinds self (IX) for bodies that use it; every callee saves the registers
+ * it changes, so a body that leaves IX or IY alone needn't save them at all
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *self, *SELF_TYPE;
+
+namespace {
+
+// variable names are checked without regard to scope: a let or case variable
+// that shadows an attribute or formal only makes the result more conservative
+void FindFrameUses(Expression* expr, const std::set<Symbol*>& formals,
+				   const VariableEnvironment& varEnv, FrameUse& use) {
+	expr->ForEachChild([&](Expression* child) { FindFrameUses(child, formals, varEnv, use); });
+
+	Symbol* name = nullptr;
+	if (Ref* ref = dynamic_cast<Ref*>(expr)) {
+		name = ref->name();
+	} else if (Assign* assign = dynamic_cast<Assign*>(expr)) {
+		name = assign->name();
+	} else if (Knew* knew = dynamic_cast<Knew*>(expr)) {
+		use.self |= (knew->name() == SELF_TYPE); // reads self's class tag
+		return;
+	} else {
+		return;
+	}
+
+	if (name == self) {
+		use.self = true;
+	} else if (formals.count(name)) {
+		use.formals = true;
+	} else {
+		auto it = varEnv.vars_.find(name);
+		use.self |= (it != varEnv.vars_.end() && !it->second.empty()); // attribute
+	}
+}
+
+}
+
+FrameUse CgenFrameUse(Method* method, VariableEnvironment& varEnv) {
+	std::set<Symbol*> formals;
+	for (auto formal = method->formals_begin(); formal != method->formals_end(); ++formal) {
+		formals.insert((*formal)->name());
+	}
+	FrameUse use;
+	use.self = use.formals = false;
+	FindFrameUses(method->body(), formals, varEnv, use);
+	return use;
+}
+
+} // namespace cool
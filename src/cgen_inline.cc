@@ -0,0 +1,100 @@
+/* cgen_inline.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * selects small methods (accessors, setters, simple arithmetic) to be
+ * expanded in place of direct (static or devirtualized) calls;
+ * the expansion itself is done by Dispatch::CodeGenInline. With a profile
+ * the calls made most often get the budget first and those never made none.
+ */
+
+#include <algorithm>
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+
+namespace {
+
+const int kInlineMaxNodes = 8;     // largest callee body (in AST nodes) considered for inlining
+const int kNodeBytes = 12;         // rough code size of an expression node
+const int kArgBytes = 4;           // storing an actual in a frame slot instead of push/pop
+const int kCallBytes = 11;         // call + void check of a direct call
+
+// counts nodes of an expression; sets excluded if it contains a dispatch,
+// so that inlined bodies never contain further (possibly recursive) calls,
+// or a variable, whose frame slot would depend on the call site (see cgen_slots.cc)
+int CountNodes(Expression* expr, bool& excluded) {
+	if (dynamic_cast<Dispatch*>(expr) != nullptr || dynamic_cast<Let*>(expr) != nullptr
+		|| dynamic_cast<Kase*>(expr) != nullptr) {
+		excluded = true;
+	}
+	int count = 1;
+	expr->ForEachChild([&](Expression* child) { count += CountNodes(child, excluded); });
+	return count;
+}
+
+void CollectCalls(Expression* expr, Klass* klass, std::vector<std::pair<Dispatch*,Klass*>>& calls) {
+	expr->ForEachChild([&](Expression* child) { CollectCalls(child, klass, calls); });
+
+	if (Dispatch* dispatch = dynamic_cast<Dispatch*>(expr)) {
+		calls.push_back(std::make_pair(dispatch, klass));
+	}
+}
+
+void InlineCall(Dispatch* dispatch, Klass* klass) {
+	const Symbol* target = dispatch->DirectTarget(klass);
+	if (target == nullptr) {
+		return;
+	}
+	CgenNode* node = gCgenKlassTable->ClassFind(const_cast<Symbol*>(target));
+	if (node->basic()) {
+		return; // implemented in assembly
+	}
+	Method* callee = node->klass()->method(dispatch->name());
+
+	bool excluded = false;
+	int nodes = CountNodes(callee->body(), excluded);
+	if (excluded || nodes > kInlineMaxNodes) {
+		return;
+	}
+
+	int growth = nodes * kNodeBytes + dispatch->actuals_size() * kArgBytes - kCallBytes;
+	if (gCgenStats.inline_growth + growth > cgen_inline_growth) {
+		return;
+	}
+
+	dispatch->set_inline(callee, node->klass());
+	gCgenStats.inline_growth += growth;
+	++gCgenStats.inlined;
+}
+
+}
+
+void CgenInline(Program* program) {
+	std::vector<std::pair<Dispatch*,Klass*>> calls;
+	for (Klass* klass : *program->klasses()) {
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			if ((*feature)->method()) {
+				Method* method = (Method*) (*feature);
+				CollectCalls(method->body(), klass, calls);
+			}
+		}
+	}
+
+	if (gCgenProfile.loaded()) {
+		calls.erase(std::remove_if(calls.begin(), calls.end(),
+		                           [](const std::pair<Dispatch*,Klass*>& call) {
+			                           return gCgenProfile.Total(call.first) == 0;
+		                           }), calls.end());
+		std::stable_sort(calls.begin(), calls.end(),
+		                 [](const std::pair<Dispatch*,Klass*>& a, const std::pair<Dispatch*,Klass*>& b) {
+			                 return gCgenProfile.Total(a.first) > gCgenProfile.Total(b.first);
+		                 });
+	}
+	for (const auto& call : calls) {
+		InlineCall(call.first, call.second);
+	}
+}
+
+} // namespace cool
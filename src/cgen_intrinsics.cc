@@ -0,0 +1,95 @@
+/* cgen_intrinsics.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * builtin intrinsics (pass intrinsics): direct calls of library methods whose
+ * target is known (String cannot be inherited from; for IO and Object see
+ * Dispatch::DirectTarget) are lowered instead of calling the library routine:
+ * - String.length is the size field less the header and the null terminator,
+ *   computed inline and boxed, or left unboxed as an operand of an arithmetic
+ *   or comparison operator (see BinaryOperator::CodeGen);
+ * - Object.type_name of an Int, Bool or String is that class's name;
+ * - String.concat, IO.out_string and IO.out_int call the routine's register
+ *   entry with the argument in DE, which the caller needn't push nor pop
+ *   and the routine needn't find under its return address.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern int label_counter;
+extern CgenKlassTable* gCgenKlassTable;
+extern Symbol *Bool, *concat, *Int, *IO, *length, *Object, *out_int, *out_string, *self, *String,
+	*type_name;
+
+namespace {
+
+// HL = length of the String in HL
+void EmitLength(std::ostream& os) {
+	emit_add_hl(SIZE_OFFSET * WORD_SIZE, os);
+	emit_load_hl_indirect(os); // object size
+	const int16_t header = (DEFAULT_OBJFIELDS + STRING_SLOTS) * WORD_SIZE + 1; // and the null terminator
+	emit_load(RegisterValue(rDE), Immediate16(static_cast<int16_t>(-header)), os);
+	emit_add(rHL, rDE, os);
+}
+
+}
+
+bool Dispatch::CodeGenIntValue(VariableEnvironment& varEnv, std::ostream& os) {
+	if (!CgenPassEnabled(PASS_INTRINSICS) || name_ != length || DirectTarget(varEnv.klass_) != String) {
+		return false;
+	}
+	receiver_->CodeGen(varEnv, os); // Strings are never void
+	EmitLength(os);
+	++gCgenStats.intrinsics;
+	++gCgenStats.unboxed_lengths;
+	return true;
+}
+
+bool Dispatch::CodeGenIntrinsic(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os) {
+	Symbol* type = receiver_->type();
+	if (klass == String && name_ == length) {
+		receiver_->CodeGen(varEnv, os);
+		EmitLength(os);
+		if (gCgenKlassTable->LateBoxing()) {
+			os << EX << rDE << "," << rHL << std::endl;
+			gCgenKlassTable->EmitBoxInt(os);
+		} else {
+			emit_push(rHL, os);
+			emit_load(RegisterValue(ARG0), LabelValue(std::string(INTNAME) + std::string(PROTOBJ_SUFFIX)), os);
+			gCgenKlassTable->EmitCopy(Int, os);
+			emit_pop(rDE, os);
+			emit_store_int(rDE, RegisterPointer(ARG0), os);
+		}
+	} else if (klass == Object && name_ == type_name && (type == Int || type == Bool || type == String)) {
+		if (!receiver_->Pure()) {
+			receiver_->CodeGen(varEnv, os);
+		}
+		emit_load(RegisterValue(ARG0), CgenRef(gStringTable.lookup(type->value())), os);
+	} else if ((klass == String && name_ == concat) || (klass == IO && (name_ == out_string || name_ == out_int))) {
+		CallConvention call;
+		call.registers = 1;
+		CodeGenActuals(call, true, -1, varEnv, os);
+		// self and Strings are never void
+		Ref* ref = dynamic_cast<Ref*>(receiver_);
+		if (klass == IO && (ref == nullptr || ref->name() != self)) {
+			const int dispatch_ok = label_counter++;
+			os << XOR << ACC << std::endl;
+			emit_or(rH, os);
+			emit_or(rL, os);
+			emit_jr(dispatch_ok, Flags::NZ, os);
+			emit_load(RegisterValue(rDE), Immediate16(static_cast<uint16_t>(this->loc())), os);
+			emit_load(RegisterValue(ARG0), CgenRef(gStringTable.lookup(varEnv.klass_->filename()->value())), os);
+			const AbsoluteAddress disp_abort("_dispatch_abort");
+			emit_jp(disp_abort, Flags::none, os);
+			emit_label_def(dispatch_ok, os);
+		}
+		os << CALL << klass->value() << METHOD_SEP << name_ << "_" << std::endl;
+	} else {
+		return false;
+	}
+	++gCgenStats.intrinsics;
+	return true;
+}
+
+} // namespace cool
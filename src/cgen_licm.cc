@@ -0,0 +1,93 @@
+/* cgen_licm.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * loop-invariant code motion (pass licm): subexpressions of a while
+ * loop that are evaluated on every iteration, whose value can't change
+ * between iterations, and whose evaluation has no side effects and can't
+ * fail, are evaluated once into a new let variable wrapped around the loop.
+ * Literals and variables are left in place, since reading a frame slot
+ * costs as much as reading them.
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+
+namespace {
+
+int hoist_counter = 0;
+
+// applies f to the subexpressions evaluated whenever expr is: not to the branches of a
+// conditional or case, nor to the body of a loop
+void MapUnconditional(Expression* expr, const std::function<Expression*(Expression*)>& f) {
+	const bool first_only = dynamic_cast<Cond*>(expr) != nullptr || dynamic_cast<Kase*>(expr) != nullptr
+		|| dynamic_cast<Loop*>(expr) != nullptr;
+	int index = 0;
+	expr->MapChildren([&](Expression* child) { return (index++ == 0 || !first_only) ? f(child) : child; });
+}
+
+// operations worth a frame slot: everything but literals and variables
+bool Computes(Expression* expr) {
+	return dynamic_cast<Dispatch*>(expr) != nullptr || dynamic_cast<BinaryOperator*>(expr) != nullptr
+		|| dynamic_cast<UnaryOperator*>(expr) != nullptr || dynamic_cast<Cond*>(expr) != nullptr;
+}
+
+// moves the invariant subexpressions of loops (innermost first) into lets around them
+Expression* HoistInvariants(Expression* expr, Klass* klass, Effects& effects) {
+	expr->MapChildren([&](Expression* child) { return HoistInvariants(child, klass, effects); });
+
+	Loop* loop = dynamic_cast<Loop*>(expr);
+	if (loop == nullptr) {
+		return expr;
+	}
+
+	const Effects::Region region = effects.Scan(loop, klass);
+	std::vector<std::pair<Symbol*,Expression*>> hoisted;
+	std::function<Expression*(Expression*)> hoist = [&](Expression* child) -> Expression* {
+		if (Computes(child) && effects.Invariant(child, region, klass)) {
+			Symbol* name = gIdentTable.emplace("_licm" + std::to_string(hoist_counter++));
+			hoisted.emplace_back(name, child);
+			Ref* ref = Ref::Create(name, child->loc());
+			ref->set_type(child->type());
+			++gCgenStats.hoisted;
+			return ref;
+		}
+		MapUnconditional(child, hoist);
+		return child;
+	};
+	// only from what runs on every iteration: hoisting a computation that most
+	// iterations skip can cost more than it saves
+	loop->MapChildren(hoist);
+
+	Expression* result = loop;
+	for (auto it = hoisted.rbegin(); it != hoisted.rend(); ++it) {
+		Let* let = Let::Create(it->first, it->second->type(), it->second, result, loop->loc());
+		let->set_type(loop->type());
+		result = let;
+	}
+	return result;
+}
+
+}
+
+void CgenHoistInvariants(Program* program) {
+	Effects effects;
+	for (Klass* klass : *program->klasses()) {
+		if (gCgenKlassTable->ClassFind(klass->name())->basic()) {
+			continue;
+		}
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			if ((*feature)->method()) {
+				Method* method = (Method*) *feature;
+				method->set_body(HoistInvariants(method->body(), klass, effects));
+			} else {
+				Attr* attr = (Attr*) *feature;
+				attr->set_init(HoistInvariants(attr->init(), klass, effects));
+			}
+		}
+	}
+}
+
+} // namespace cool
@@ -0,0 +1,206 @@
+/* cgen_lvn.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * local value numbering (pass lvn, also off with -f value-numbering=0):
+ * a method body is split into straight-line regions, which end where a
+ * branch of a conditional or case, the body of a loop or the body of a let
+ * begins. Within a region, computations with the same value number (the
+ * same operation on the same values) are evaluated once, into a new let
+ * variable wrapped around the region, if the region can't change what they
+ * read. Reloading a variable that is still in HL is left to code
+ * generation (see Ref::CodeGen).
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+
+namespace {
+
+int number_counter = 0;
+
+// children of expr that start regions of their own
+bool StartsRegion(Expression* expr, int index) {
+	if (dynamic_cast<Cond*>(expr) != nullptr || dynamic_cast<Kase*>(expr) != nullptr
+		|| dynamic_cast<Loop*>(expr) != nullptr || dynamic_cast<Let*>(expr) != nullptr) {
+		return index > 0;
+	}
+	return dynamic_cast<KaseBranch*>(expr) != nullptr;
+}
+
+// applies f to the children of expr in the same region
+void MapRegion(Expression* expr, const std::function<Expression*(Expression*)>& f) {
+	int index = 0;
+	expr->MapChildren([&](Expression* child) { return StartsRegion(expr, index++) ? child : f(child); });
+}
+
+std::vector<Expression*> Children(Expression* expr) {
+	std::vector<Expression*> children;
+	expr->ForEachChild([&](Expression* child) { children.push_back(child); });
+	return children;
+}
+
+// same operation on the same values (given that the region changes none of them)
+bool SameValue(Expression* lhs, Expression* rhs) {
+	if (typeid(*lhs) != typeid(*rhs)) {
+		return false;
+	}
+	if (Ref* ref = dynamic_cast<Ref*>(lhs)) {
+		return ref->name() == ((Ref*) rhs)->name();
+	} else if (IntLiteral* lit = dynamic_cast<IntLiteral*>(lhs)) {
+		return lit->value() == ((IntLiteral*) rhs)->value();
+	} else if (BoolLiteral* lit = dynamic_cast<BoolLiteral*>(lhs)) {
+		return lit->value() == ((BoolLiteral*) rhs)->value();
+	} else if (StringLiteral* lit = dynamic_cast<StringLiteral*>(lhs)) {
+		return lit->value() == ((StringLiteral*) rhs)->value();
+	} else if (BinaryOperator* binop = dynamic_cast<BinaryOperator*>(lhs)) {
+		if (binop->kind() != ((BinaryOperator*) rhs)->kind()) {
+			return false;
+		}
+	} else if (UnaryOperator* unop = dynamic_cast<UnaryOperator*>(lhs)) {
+		if (unop->kind() != ((UnaryOperator*) rhs)->kind()) {
+			return false;
+		}
+	} else if (Dispatch* dispatch = dynamic_cast<Dispatch*>(lhs)) {
+		StaticDispatch* stat = dynamic_cast<StaticDispatch*>(lhs);
+		if (dispatch->name() != ((Dispatch*) rhs)->name()
+			|| (stat != nullptr && stat->dispatch_type() != ((StaticDispatch*) rhs)->dispatch_type())) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+
+	const std::vector<Expression*> lhs_children = Children(lhs);
+	const std::vector<Expression*> rhs_children = Children(rhs);
+	if (lhs_children.size() != rhs_children.size()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < lhs_children.size(); ++i) {
+		if (!SameValue(lhs_children[i], rhs_children[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// computations worth a frame slot when shared
+bool Computes(Expression* expr) {
+	return dynamic_cast<Dispatch*>(expr) != nullptr || dynamic_cast<BinaryOperator*>(expr) != nullptr;
+}
+
+void FindComputations(Expression* expr, std::vector<Expression*>& found) {
+	if (Computes(expr)) {
+		found.push_back(expr);
+	}
+	MapRegion(expr, [&](Expression* child) { FindComputations(child, found); return child; });
+}
+
+class ValueNumbering {
+ public:
+	ValueNumbering(Klass* klass, Effects& effects) : klass_(klass), effects_(effects) {}
+
+	/// Number the region starting at root and the regions nested in it
+	/// \return expression to replace root with
+	Expression* Number(Expression* root);
+
+	int numbered() const { return numbered_; }
+
+ private:
+	Klass* klass_;
+	Effects& effects_;
+	int numbered_ = 0;
+
+	void NumberNested(Expression* expr);
+};
+
+Expression* ValueNumbering::Number(Expression* root) {
+	NumberNested(root);
+
+	const Effects::Region region = effects_.Scan(root, klass_);
+	std::vector<std::pair<Symbol*,Expression*>> shared;
+	for (bool changed = true; changed; ) {
+		changed = false;
+		std::vector<Expression*> found;
+		FindComputations(root, found);
+
+		// the outermost computation that is repeated
+		for (std::size_t i = 0; i < found.size() && !changed; ++i) {
+			int repeats = 0;
+			for (std::size_t j = i + 1; j < found.size(); ++j) {
+				repeats += SameValue(found[i], found[j]);
+			}
+			if (repeats == 0 || !effects_.Invariant(found[i], region, klass_)) {
+				continue;
+			}
+
+			Expression* value = found[i];
+			Symbol* name = gIdentTable.emplace("_lvn" + std::to_string(number_counter++));
+			std::function<Expression*(Expression*)> replace = [&](Expression* expr) -> Expression* {
+				if (SameValue(expr, value)) {
+					Ref* ref = Ref::Create(name, expr->loc());
+					ref->set_type(expr->type());
+					return ref;
+				}
+				MapRegion(expr, replace);
+				return expr;
+			};
+			MapRegion(root, replace);
+			shared.emplace_back(name, value);
+			numbered_ += repeats;
+			changed = true;
+		}
+	}
+
+	for (auto it = shared.rbegin(); it != shared.rend(); ++it) {
+		Let* let = Let::Create(it->first, it->second->type(), it->second, root, root->loc());
+		let->set_type(root->type());
+		root = let;
+	}
+	return root;
+}
+
+void ValueNumbering::NumberNested(Expression* expr) {
+	int index = 0;
+	expr->MapChildren([&](Expression* child) -> Expression* {
+		if (!StartsRegion(expr, index++)) {
+			NumberNested(child);
+			return child;
+		}
+		if (dynamic_cast<KaseBranch*>(child) != nullptr) {
+			NumberNested(child); // the branch's body is the region, not the branch itself
+			return child;
+		}
+		return Number(child);
+	});
+}
+
+}
+
+void CgenValueNumbering(Program* program) {
+	Effects effects;
+	for (Klass* klass : *program->klasses()) {
+		if (gCgenKlassTable->ClassFind(klass->name())->basic()) {
+			continue;
+		}
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			ValueNumbering numbering(klass, effects);
+			if ((*feature)->method()) {
+				Method* method = (Method*) *feature;
+				method->set_body(numbering.Number(method->body()));
+				if (numbering.numbered() > 0) {
+					gCgenStats.numbered_methods[klass->name()->value() + "." + method->name()->value()].first
+						+= numbering.numbered();
+				}
+			} else {
+				Attr* attr = (Attr*) *feature;
+				attr->set_init(numbering.Number(attr->init()));
+			}
+			gCgenStats.numbered += numbering.numbered();
+		}
+	}
+}
+
+} // namespace cool
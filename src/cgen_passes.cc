@@ -0,0 +1,168 @@
+/* cgen_passes.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * the pass manager: every optimization is a named pass, enabled by the
+ * optimization level (-O0, -O1, -O2 or -Os; -O is -O2) unless
+ * -f enable=NAME or -f disable=NAME says otherwise. Program passes rewrite
+ * or annotate the AST before code generation, in the order of kPasses, and
+ * are timed one by one; code generation passes are choices the code
+ * generator makes as it goes (see CgenPassEnabled) and share its time.
+ * With -R each enabled pass reports its time and the changes it made;
+ * -f dump-after=NAME writes the AST as the passes after NAME see it.
+ */
+
+#include <chrono>
+#include <iomanip>
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+
+namespace {
+
+enum Level { O1 = 1, O2 = 2, Os = 4 };
+
+struct PassInfo {
+	CgenPass pass;
+	const char* name;
+	int levels;                    // levels that enable it
+	bool early;                    // program pass run before the class table is built
+	void (*run)(Program* program); // program pass, or nullptr for a code generation pass
+	int (*changes)();              // what it changed, in gCgenStats
+	const char* unit;
+};
+
+const PassInfo kPasses[] = { // in CgenPass order
+	{ PASS_FOLD, "fold", O1|O2|Os, true, CgenFold,
+	  [] { return gCgenStats.folded; }, "expressions" },
+	{ PASS_LICM, "licm", O2|Os, false, CgenHoistInvariants,
+	  [] { return gCgenStats.hoisted; }, "hoisted" },
+	{ PASS_LVN, "lvn", O2|Os, false, CgenValueNumbering,
+	  [] { return gCgenStats.numbered + gCgenStats.loads_removed; }, "values & loads" },
+	{ PASS_DCE, "dce", O1|O2|Os, false, CgenEliminateDead,
+	  [] { return gCgenStats.dead_values + gCgenStats.dead_stores; }, "values & stores" },
+	{ PASS_INLINE, "inline", O2, false, CgenInline,
+	  [] { return gCgenStats.inlined; }, "call sites" },
+	{ PASS_REACH, "reach", O1|O2|Os, false, CgenReach,
+	  [] { return gCgenStats.dead_methods + gCgenStats.dead_inits; }, "methods & initializers" },
+	{ PASS_TAIL_CALLS, "tail-calls", O1|O2|Os, false, CgenTailCalls,
+	  [] { return gCgenStats.tail_calls; }, "calls" },
+	{ PASS_DISPTAB, "disptab", O1|O2|Os, false,
+	  [](Program* program) { gCgenKlassTable->CompactDispatchTables(program); },
+	  [] { return gCgenStats.disptab_bytes - gCgenStats.compact_bytes; }, "bytes" },
+	{ PASS_DEVIRTUALIZE, "devirtualize", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.devirtualized; }, "dispatches" },
+	{ PASS_FRAME, "frame", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.frameless + gCgenStats.unbound_self; }, "prologues" },
+	{ PASS_STRENGTH, "strength", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.reduced; }, "operations" },
+	{ PASS_COPY, "copy", O2, false, nullptr,
+	  [] { return gCgenStats.copies; }, "sites" },
+	{ PASS_INT_CACHE, "int-cache", O2, false, nullptr,
+	  [] { return gCgenStats.boxed; }, "sites" },
+	{ PASS_RELAX, "relax", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.shortened_branches; }, "branches" },
+	{ PASS_TEMPLATES, "templates", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.templated; }, "sequences" },
+	{ PASS_PROFILE, "profile", O2, false, nullptr,
+	  [] { return gCgenStats.guarded + gCgenStats.hot_arms + gCgenStats.rotated_loops; }, "sites" },
+	{ PASS_REG_ARGS, "reg-args", 0, false, nullptr,
+	  [] { return gCgenStats.register_args; }, "arguments" },
+	{ PASS_INTRINSICS, "intrinsics", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.intrinsics; }, "sites" },
+	{ PASS_COMPARE, "compare", O1|O2|Os, false, nullptr,
+	  [] { return gCgenStats.flag_branches; }, "branches" },
+};
+static_assert(sizeof(kPasses) / sizeof(kPasses[0]) == PASS_COUNT, "every pass needs an entry");
+
+int level = 0;                     // no optimization until -O
+int forced[PASS_COUNT];            // 1 enabled, -1 disabled by -f, 0 as the level says
+double times[PASS_COUNT];          // ms
+const PassInfo* dump_after = nullptr;
+
+const PassInfo* Find(const std::string& name) {
+	for (const PassInfo& info : kPasses) {
+		if (name == info.name) {
+			return &info;
+		}
+	}
+	return nullptr;
+}
+
+}
+
+bool CgenSetLevel(const std::string& name) {
+	if (name == "0") {
+		level = 0;
+	} else if (name == "1") {
+		level = O1;
+	} else if (name == "2") {
+		level = O2;
+	} else if (name == "s") {
+		level = Os;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool CgenSetPass(const std::string& name, bool enabled) {
+	const PassInfo* info = Find(name);
+	if (info == nullptr) {
+		return false;
+	}
+	forced[info->pass] = enabled ? 1 : -1;
+	return true;
+}
+
+bool CgenSetDumpAfter(const std::string& name) {
+	const PassInfo* info = Find(name);
+	if (info == nullptr || info->run == nullptr) {
+		return false;
+	}
+	dump_after = info;
+	return true;
+}
+
+bool CgenPassEnabled(CgenPass pass) {
+	return (forced[pass] != 0) ? (forced[pass] > 0) : (kPasses[pass].levels & level) != 0;
+}
+
+void CgenRunPasses(Program* program, bool early) {
+	for (const PassInfo& info : kPasses) {
+		if (info.run == nullptr || info.early != early) {
+			continue;
+		}
+		if (CgenPassEnabled(info.pass)) {
+			const auto start = std::chrono::steady_clock::now();
+			info.run(program);
+			const std::chrono::duration<double,std::milli> time = std::chrono::steady_clock::now() - start;
+			times[info.pass] = time.count();
+		}
+		if (dump_after == &info) {
+			std::cerr << "# after " << info.name << (CgenPassEnabled(info.pass) ? "" : " (disabled)") << std::endl;
+			program->DumpTree(std::cerr, 0, true);
+		}
+	}
+}
+
+void CgenReportPasses(std::ostream& os, double codegen_ms) {
+	os << "passes:" << std::endl;
+	for (const PassInfo& info : kPasses) {
+		if (!CgenPassEnabled(info.pass)) {
+			continue;
+		}
+		os << "  " << std::left << std::setw(14) << info.name << std::right << std::setw(8);
+		if (info.run != nullptr) {
+			os << std::fixed << std::setprecision(2) << times[info.pass] << " ms";
+		} else {
+			os << "-" << "   ";
+		}
+		os << "  " << info.changes() << " " << info.unit << std::endl;
+	}
+	os << "  " << std::left << std::setw(14) << "(codegen)" << std::right << std::setw(8)
+	   << std::fixed << std::setprecision(2) << codegen_ms << " ms" << std::endl;
+}
+
+} // namespace cool
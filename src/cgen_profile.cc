@@ -0,0 +1,200 @@
+/* cgen_profile.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * profile-guided optimization: with -f profile-generate the program counts
+ * method entries, the arms conditionals take, loop iterations and the classes
+ * of dispatch receivers into an appvar (see profile.z80); with
+ * -f profile-use=FILE those counts decide what is inlined first (see
+ * cgen_inline.cc), which receiver class a dynamic dispatch tests for before
+ * using the dispatch table, how conditionals and loops are laid out and in
+ * which order methods are placed.
+ *
+ * Counters belong to sites, numbered in source order before any optimization
+ * rewrites the program, so an optimized and an unoptimized build of the same
+ * program agree on them. The appvar starts with a check of the site numbering;
+ * a profile of another program (or of an older version of it) is ignored.
+ */
+
+#include <fstream>
+#include <iterator>
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *SELF_TYPE;
+
+CgenProfile gCgenProfile;
+
+namespace {
+
+const char kAppVarSignature[] = "**TI83F*"; // .8xv file, as sent from the calculator
+const std::size_t kFileHeader = 55;       // signature, comment and data length before the variable
+
+uint16_t Word(const std::string& bytes, std::size_t at) {
+	return (uint8_t) bytes[at] | ((uint8_t) bytes[at + 1] << 8);
+}
+
+}
+
+void CgenProfile::NumberSites(Program* program) {
+	for (Klass* klass : *program->klasses()) {
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			const std::string owner = klass->name()->value() + "." + (*feature)->name()->value();
+			int n = 0;
+			if ((*feature)->method()) {
+				Method* method = (Method*) *feature;
+				AddSite(method, 'm', owner, nullptr);
+				NumberSites(method->body(), klass, owner, n);
+			} else {
+				NumberSites(((Attr*) *feature)->init(), klass, owner, n);
+			}
+		}
+	}
+}
+
+void CgenProfile::NumberSites(Expression* expr, Klass* klass, const std::string& owner, int& n) {
+	const std::string id = owner + "#" + std::to_string(n + 1);
+	if (Dispatch* dispatch = dynamic_cast<Dispatch*>(expr)) {
+		Symbol* type = dispatch->receiver()->type();
+		AddSite(expr, 'd', id, type == SELF_TYPE ? klass->name() : type);
+		++n;
+	} else if (dynamic_cast<Cond*>(expr) != nullptr) {
+		AddSite(expr, 'c', id, nullptr);
+		++n;
+	} else if (dynamic_cast<Loop*>(expr) != nullptr) {
+		AddSite(expr, 'l', id, nullptr);
+		++n;
+	}
+	expr->ForEachChild([&](Expression* child) { NumberSites(child, klass, owner, n); });
+}
+
+void CgenProfile::AddSite(ASTNode* node, char kind, const std::string& id, Symbol* receiver) {
+	node->set_profile_site(sites_.size());
+	Site site;
+	site.kind = kind;
+	site.id = id;
+	site.receiver = receiver;
+	sites_.push_back(site);
+}
+
+void CgenProfile::Layout(const CgenKlassTable& table) {
+	classes_.assign(table.root()->max_tag() + 1, nullptr);
+	std::function<void(const CgenNode*)> visit = [&](const CgenNode* node) {
+		classes_[node->tag()] = node;
+		for (const CgenNode* child : node->children_) {
+			visit(child);
+		}
+	};
+	visit(table.root());
+
+	// FNV-1a of the sites and their counters
+	uint32_t hash = 2166136261u;
+	auto mix = [&](const std::string& s) {
+		for (char c : s) {
+			hash = (hash ^ (uint8_t) c) * 16777619u;
+		}
+	};
+	counters_ = 0;
+	for (Site& site : sites_) {
+		site.first = counters_;
+		switch (site.kind) {
+		case 'm': site.counters = 1; break;  // entries
+		case 'c': site.counters = 2; break;  // then arm, else arm
+		case 'l': site.counters = 2; break;  // entries, iterations
+		case 'd': {                          // one per class in the receiver's static type's subtree
+			const CgenNode* node = table.ClassFind(site.receiver);
+			site.tag = node->tag();
+			site.counters = node->max_tag() - node->tag() + 1;
+			break;
+		}
+		}
+		counters_ += site.counters;
+		mix(std::string(1, site.kind) + site.id + ":" + std::to_string(site.counters) + ";");
+	}
+	check_ = (hash ^ (hash >> 16)) & 0xFFFF;
+}
+
+bool CgenProfile::Load(const char* path) {
+	std::ifstream in(path, std::ios::binary);
+	const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (!in.good() && !in.eof()) {
+		std::cerr << "profile: cannot read " << path << "; ignored" << std::endl;
+		return false;
+	}
+
+	// .8xv: the variable's header (its length first), the variable's length, then the appvar's size word
+	std::size_t begin = 0;
+	if (bytes.compare(0, sizeof(kAppVarSignature) - 1, kAppVarSignature) == 0 && bytes.size() > kFileHeader + 2) {
+		begin = kFileHeader + 2 + Word(bytes, kFileHeader) + 2 + 2;
+	}
+	if (bytes.size() < begin + 4 || Word(bytes, begin) != check_ || Word(bytes, begin + 2) != counters_
+		|| bytes.size() < begin + 4 + 4 * counters_) {
+		std::cerr << "profile: " << path << " is not a profile of this program; ignored" << std::endl;
+		return false;
+	}
+
+	counts_.resize(counters_);
+	for (int i = 0; i < counters_; ++i) {
+		const std::size_t at = begin + 4 + 4 * i;
+		counts_[i] = Word(bytes, at) | ((uint32_t) Word(bytes, at + 2) << 16);
+	}
+	return true;
+}
+
+uint32_t CgenProfile::Count(const ASTNode* node, int i) const {
+	if (counts_.empty() || node->profile_site() < 0) {
+		return 0;
+	}
+	return counts_[sites_[node->profile_site()].first + i];
+}
+
+uint64_t CgenProfile::Total(const ASTNode* node) const {
+	uint64_t total = 0;
+	if (!counts_.empty() && node->profile_site() >= 0) {
+		for (int i = 0; i < sites_[node->profile_site()].counters; ++i) {
+			total += Count(node, i);
+		}
+	}
+	return total;
+}
+
+const CgenNode* CgenProfile::HotReceiver(const Dispatch* dispatch) const {
+	const uint64_t total = Total(dispatch);
+	if (total == 0) {
+		return nullptr;
+	}
+	const Site& site = sites_[dispatch->profile_site()];
+	int hot = 0;
+	for (int i = 1; i < site.counters; ++i) {
+		if (Count(dispatch, i) > Count(dispatch, hot)) {
+			hot = i;
+		}
+	}
+	return (Count(dispatch, hot) * 4 >= total * 3) ? classes_[site.tag + hot] : nullptr;
+}
+
+void CgenProfile::EmitDefines(std::ostream& os) const {
+	os << DEFINE << "_profile" << std::endl;
+	os << DEFINE << "_profile_check " << check_ << std::endl;
+	os << DEFINE << "_profile_counters " << counters_ << std::endl;
+	gCgenStats.profile_counters = counters_;
+}
+
+void CgenProfile::EmitCount(const ASTNode* node, int i, std::ostream& os) const {
+	if (!cgen_profile_generate || node->profile_site() < 0) {
+		return;
+	}
+	os << CALL << "_profile_count" << std::endl;
+	os << DW << 4 * (sites_[node->profile_site()].first + i) << std::endl;
+}
+
+void CgenProfile::EmitReceiver(const Dispatch* dispatch, std::ostream& os) const {
+	if (!cgen_profile_generate || dispatch->profile_site() < 0) {
+		return;
+	}
+	const Site& site = sites_[dispatch->profile_site()];
+	os << CALL << "_profile_receiver" << std::endl;
+	os << DW << (4 * (site.first - site.tag) & 0xFFFF) << std::endl; // the routine adds 4 * tag
+}
+
+} // namespace cool
@@ -0,0 +1,186 @@
+/* cgen_reach.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * rapid type analysis: starting from Main.main, finds which classes are
+ * instantiated and which methods can be called, so that code generation
+ * can drop unreachable methods, initializers, prototype objects, dispatch
+ * tables and runtime library routines
+ */
+
+#include <deque>
+#include "cgen.h"
+
+namespace cool {
+
+extern CgenKlassTable* gCgenKlassTable;
+extern Symbol *Bool, *cool_abort, *copy, *Int, *IO, *Main, *main_meth, *out_int, *out_string,
+	*SELF_TYPE, *String, *type_name;
+
+class ReachAnalysis {
+ public:
+	static void Clear(CgenNode* node);
+	static void Count(CgenNode* node);
+
+	void Instantiate(CgenNode* node);
+	void Call(CgenNode* klass, Symbol* method);
+	void Run();
+
+ private:
+	std::deque<std::pair<Expression*,Klass*>> todo_;   // expressions left to scan
+	std::set<std::pair<CgenNode*,Symbol*>> sites_;     // (static type, method) of dynamic dispatches
+	std::vector<CgenNode*> instantiated_;
+
+	void Scan(Expression* expr, Klass* klass);
+	void Site(CgenNode* type, Symbol* method);
+};
+
+namespace {
+
+bool Conforms(const CgenNode* node, const CgenNode* type) {
+	for (; node != nullptr; node = node->parent()) {
+		if (node == type) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+void ReachAnalysis::Instantiate(CgenNode* node) {
+	if (node->instantiated_) {
+		return;
+	}
+	node->instantiated_ = true;
+	instantiated_.push_back(node);
+
+	// the initializer calls those of all ancestors
+	for (CgenNode* init = node; init != nullptr && !init->initialized_; init = init->parent()) {
+		init->initialized_ = true;
+		for (auto feature = init->klass()->features_begin(); feature != init->klass()->features_end(); ++feature) {
+			if ((*feature)->attr()) {
+				todo_.emplace_back(((Attr*) *feature)->init(), init->klass());
+			}
+		}
+	}
+
+	for (const auto& site : sites_) {
+		if (Conforms(node, site.first)) {
+			Call(node, site.second);
+		}
+	}
+}
+
+// marks the implementation of method used by objects of class klass
+void ReachAnalysis::Call(CgenNode* klass, Symbol* method) {
+	CgenNode* impl = gCgenKlassTable->ClassFind(const_cast<Symbol*>(klass->dispTab()[method].klass_));
+	if (impl->dead_methods_.erase(method) == 0) {
+		return; // already reachable
+	}
+	if (impl->basic()) {
+		if (method == cool_abort) {
+			Call(impl, type_name); // Object.abort prints the class name
+		}
+	} else {
+		todo_.emplace_back(impl->klass()->method(method)->body(), impl->klass());
+	}
+}
+
+// dynamic dispatch: any instantiated subclass of the static type may be the receiver
+void ReachAnalysis::Site(CgenNode* type, Symbol* method) {
+	if (!sites_.emplace(type, method).second) {
+		return;
+	}
+	for (CgenNode* node : instantiated_) {
+		if (Conforms(node, type)) {
+			Call(node, method);
+		}
+	}
+}
+
+void ReachAnalysis::Scan(Expression* expr, Klass* klass) {
+	expr->ForEachChild([&](Expression* child) { Scan(child, klass); });
+
+	if (Knew* knew = dynamic_cast<Knew*>(expr)) {
+		// new SELF_TYPE has the class of self, which is already instantiated
+		if (knew->name() != SELF_TYPE) {
+			Instantiate(gCgenKlassTable->ClassFind(knew->name()));
+		}
+		return;
+	}
+
+	Dispatch* dispatch = dynamic_cast<Dispatch*>(expr);
+	if (dispatch == nullptr) {
+		return;
+	}
+	if (dispatch->inline_callee() != nullptr) {
+		Scan(dispatch->inline_callee()->body(), dispatch->inline_klass());
+	} else if (dynamic_cast<StaticDispatch*>(dispatch) != nullptr) {
+		const Symbol* target = dispatch->DirectTarget(klass);
+		Call(gCgenKlassTable->ClassFind(const_cast<Symbol*>(target)), dispatch->name());
+	} else {
+		Symbol* type = dispatch->receiver()->type();
+		Site(gCgenKlassTable->ClassFind(type == SELF_TYPE ? klass->name() : type), dispatch->name());
+	}
+}
+
+void ReachAnalysis::Run() {
+	while (!todo_.empty()) {
+		std::pair<Expression*,Klass*> next = todo_.front();
+		todo_.pop_front();
+		Scan(next.first, next.second);
+	}
+}
+
+// start out with nothing reachable
+void ReachAnalysis::Clear(CgenNode* node) {
+	node->instantiated_ = false;
+	node->initialized_ = false;
+	for (auto feature = node->klass()->features_begin(); feature != node->klass()->features_end(); ++feature) {
+		if ((*feature)->method()) {
+			node->dead_methods_.insert(((Method*) *feature)->name());
+		}
+	}
+	for (CgenNode* child : node->children_) {
+		Clear(child);
+	}
+}
+
+void ReachAnalysis::Count(CgenNode* node) {
+	if (!node->instantiated_) {
+		++gCgenStats.dead_classes;
+		// prototype object (GC tag + object) and dispatch table
+		gCgenStats.dead_data += WORD_SIZE + node->objectSize_
+			+ node->dispTab_.size() * (WORD_SIZE + BYTE_SIZE);
+	}
+	if (!node->initialized_) {
+		++gCgenStats.dead_inits;
+	}
+	gCgenStats.dead_methods += node->dead_methods_.size();
+	for (CgenNode* child : node->children_) {
+		Count(child);
+	}
+}
+
+void CgenReach(Program* program) {
+	CgenKlassTable& table = *gCgenKlassTable;
+	ReachAnalysis::Clear(table.root());
+
+	ReachAnalysis reach;
+	// constants and the results of basic methods are Int, Bool and String objects
+	reach.Instantiate(table.ClassFind(Int));
+	reach.Instantiate(table.ClassFind(Bool));
+	reach.Instantiate(table.ClassFind(String));
+	// the runtime uses these itself (boot, abort messages)
+	reach.Call(table.root(), copy);
+	reach.Call(table.ClassFind(IO), out_string);
+	reach.Call(table.ClassFind(IO), out_int);
+
+	reach.Instantiate(table.ClassFind(Main));
+	reach.Call(table.ClassFind(Main), main_meth);
+	reach.Run();
+
+	ReachAnalysis::Count(table.root());
+}
+
+} // namespace cool
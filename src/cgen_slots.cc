@@ -0,0 +1,158 @@
+/* cgen_slots.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * frame slot allocation: let variables, case branch variables and the
+ * actuals of inlined calls are given frame slots by coloring their live
+ * intervals, instead of one slot per level of nesting. Frames too large for
+ * (iy+d) are addressed through HL beyond the reach of d, and all of them are
+ * with -f iy-flags=1 (see FrameLocation).
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+extern Symbol *self;
+
+int FrameSlots::Open(int* slot) {
+	++pos_;
+	vars_.push_back(Var{pos_, pos_, slot});
+	max_open_ = std::max(max_open_, ++open_);
+	return vars_.size() - 1;
+}
+
+void FrameSlots::Bind(Symbol* name, int var) {
+	scope_[name].push_back(var);
+}
+
+void FrameSlots::Unbind(Symbol* name) {
+	scope_[name].pop_back();
+	--open_;
+}
+
+void FrameSlots::Use(Symbol* name) {
+	auto it = scope_.find(name);
+	if (it == scope_.end() || it->second.empty()) {
+		return; // attribute or formal
+	}
+	const int var = it->second.back();
+	vars_[var].end = ++pos_;
+	for (auto& loop : loops_) {
+		loop.second.insert(var);
+	}
+}
+
+void FrameSlots::BeginLoop() {
+	loops_.emplace_back(++pos_, std::set<int>());
+}
+
+// variables defined before the loop and used in it stay live until it ends
+void FrameSlots::EndLoop() {
+	++pos_;
+	for (int var : loops_.back().second) {
+		if (vars_[var].start < loops_.back().first) {
+			vars_[var].end = std::max(vars_[var].end, pos_);
+		}
+	}
+	loops_.pop_back();
+}
+
+// greedy coloring by start of interval, which is optimal for interval graphs
+int FrameSlots::Color() {
+	std::vector<int> order(vars_.size());
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+		return vars_[lhs].start < vars_[rhs].start;
+	});
+
+	std::vector<int> slot_end; // end of the last interval in each slot
+	for (int var : order) {
+		std::size_t slot = 0;
+		while (slot < slot_end.size() && slot_end[slot] >= vars_[var].start) {
+			++slot;
+		}
+		if (slot == slot_end.size()) {
+			slot_end.push_back(0);
+		}
+		slot_end[slot] = vars_[var].end;
+		*vars_[var].slot = slot;
+	}
+	return slot_end.size();
+}
+
+std::unique_ptr<MemoryLocation> FrameLocation(int offset) {
+	if (cgen_iy_flags) {
+		return std::unique_ptr<MemoryLocation>(new MemoryPointerFar(FRAME_POINTER, offset));
+	}
+	if (offset + 1 <= INT8_MAX) {
+		return std::unique_ptr<MemoryLocation>(new RegisterPointerOffset(FP, offset));
+	}
+	return std::unique_ptr<MemoryLocation>(new RegisterPointerFar(FP, offset));
+}
+
+/* AllocSlots */
+
+void Expression::AllocSlots(FrameSlots& slots) {
+	ForEachChild([&](Expression* child) { child->AllocSlots(slots); });
+}
+
+void Ref::AllocSlots(FrameSlots& slots) {
+	if (name_ != self) {
+		slots.Use(name_);
+	}
+}
+
+void Assign::AllocSlots(FrameSlots& slots) {
+	value_->AllocSlots(slots);
+	slots.Use(name_);
+}
+
+void Loop::AllocSlots(FrameSlots& slots) {
+	slots.BeginLoop();
+	pred_->AllocSlots(slots);
+	body_->AllocSlots(slots);
+	slots.EndLoop();
+}
+
+void Let::AllocSlots(FrameSlots& slots) {
+	init_->AllocSlots(slots);
+	slots.Bind(name_, slots.Open(&slot_));
+	body_->AllocSlots(slots);
+	slots.Unbind(name_);
+}
+
+void KaseBranch::AllocSlots(FrameSlots& slots) {
+	slots.Bind(name_, slots.Open(&slot_));
+	body_->AllocSlots(slots);
+	slots.Unbind(name_);
+}
+
+// an inlined callee's formals are frame slots of the caller, stored to as each actual is
+// evaluated, but only in scope in the callee's body (which has no variables of its own)
+void Dispatch::AllocSlots(FrameSlots& slots) {
+	if (inline_ == nullptr) {
+		Expression::AllocSlots(slots);
+		return;
+	}
+
+	inline_slots_.resize(actuals_->size());
+	std::vector<int> vars;
+	for (std::size_t i = 0; i < actuals_->size(); ++i) {
+		actuals_->at(i)->AllocSlots(slots);
+		vars.push_back(slots.Open(&inline_slots_[i]));
+	}
+	receiver_->AllocSlots(slots);
+
+	auto var = vars.begin();
+	for (auto formal = inline_->formals_begin(); formal != inline_->formals_end(); ++formal, ++var) {
+		slots.Bind((*formal)->name(), *var);
+	}
+	inline_->body()->AllocSlots(slots);
+	for (auto formal = inline_->formals_begin(); formal != inline_->formals_end(); ++formal) {
+		slots.Unbind((*formal)->name());
+	}
+}
+
+} // namespace cool
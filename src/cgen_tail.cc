@@ -0,0 +1,69 @@
+/* cgen_tail.cc
+ * Copyright Nicholas Mosier 2018
+ *
+ * finds dispatches in tail position of method bodies; direct calls among
+ * them reuse the caller's argument slots and jump to the callee instead of
+ * calling it (see Dispatch::CodeGenTail), so tail recursion runs in constant
+ * stack space
+ */
+
+#include "cgen.h"
+
+namespace cool {
+
+void CgenTailCalls(Program* program) {
+	for (Klass* klass : *program->klasses()) {
+		for (auto feature = klass->features_begin(); feature != klass->features_end(); ++feature) {
+			if ((*feature)->method()) {
+				((Method*) *feature)->body()->MarkTailCalls();
+			}
+		}
+	}
+}
+
+void Dispatch::MarkTailCalls() {
+	tail_ = true;
+}
+
+void Cond::MarkTailCalls() {
+	then_branch_->MarkTailCalls();
+	else_branch_->MarkTailCalls();
+}
+
+void Block::MarkTailCalls() {
+	body_->back()->MarkTailCalls();
+}
+
+void Let::MarkTailCalls() {
+	body_->MarkTailCalls();
+}
+
+void Kase::MarkTailCalls() {
+	for (KaseBranch* branch : *cases_) {
+		branch->MarkTailCalls();
+	}
+}
+
+void KaseBranch::MarkTailCalls() {
+	body_->MarkTailCalls();
+}
+
+// A tail call to the method itself restarts its body; any other tail call pops the
+// caller's frame first and leaves the stack arguments where they are, so the callee
+// must take as many of them as the caller and pop them if the caller would (see
+// CgenCallConvention). Stack arguments are overwritten through DE, so they can't be
+// combined with register arguments.
+bool Dispatch::CanTailCall(const Symbol* klass, const VariableEnvironment& varEnv) const {
+	if (!tail_ || varEnv.method_ == nullptr) {
+		return false;
+	}
+	if (klass == varEnv.klass_->name() && name_ == varEnv.method_->name()) {
+		return true;
+	}
+	const CallConvention call = CgenCallConvention(name_, actuals_->size());
+	const CallConvention& own = varEnv.method_call_;
+	return call.stack == own.stack && call.callee_pops == own.callee_pops
+		&& (call.stack == 0 || call.registers == 0);
+}
+
+} // namespace cool
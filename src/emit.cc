@@ -9,6 +9,9 @@
 #include "stringtab.h"
 #include "cgen_supp.h"
 #include "emit.h"
+#include "cgen.h"
+
+extern bool cgen_tagged;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -82,6 +85,29 @@ void emit_load(const RegisterValue& dst, const RegisterValue& src, std::ostream&
 		throw "register values of mismatching sizes";
 	}
 }
+// HL = address of a PTR_FAR or PTR_MEM location; changes DE
+static void emit_far_address(const MemoryLocation& loc, std::ostream& os) {
+	int16_t offset;
+	if (loc.kind() == MemoryLocation::Kind::PTR_FAR) {
+		const RegisterPointerFar& far = (const RegisterPointerFar&) loc;
+		emit_push(far.reg(), os);
+		emit_pop(rHL, os);
+		offset = far.offset();
+	} else {
+		const MemoryPointerFar& far = (const MemoryPointerFar&) loc;
+		os << LD << rHL << ",(" << far.label() << ")" << std::endl;
+		offset = far.offset();
+		if (offset >= 0 && offset <= 3) {
+			for (int i = 0; i < offset; ++i) {
+				emit_inc(rHL, os);
+			}
+			return;
+		}
+	}
+	os << LD << rDE << "," << offset << std::endl;
+	emit_add(rHL, rDE, os);
+}
+
 void emit_load(const MemoryValue& dst, const RegisterValue& src, std::ostream& os) {
 	if (dst.loc().kind() == MemoryLocation::Kind::ABS) {
 		if (src.size() == 1) {
@@ -103,6 +129,24 @@ void emit_load(const MemoryValue& dst, const RegisterValue& src, std::ostream& o
 				os << LD << dst << "," << src_reg.high() << std::endl;
 				os << DEC << *dst.reg() << std::endl;
 			}
+	} else if (dst.loc().kind() == MemoryLocation::Kind::PTR_FAR
+	           || dst.loc().kind() == MemoryLocation::Kind::PTR_MEM) {
+			// HL = reg+offset, then store; all registers are preserved
+			assert (*src.reg() == rHL || *src.reg() == rDE);
+			if (*src.reg() == rHL) {
+				os << EX << rDE << "," << rHL << std::endl;
+			}
+			emit_push(rHL, os);
+			emit_push(rDE, os);
+			emit_far_address(dst.loc(), os);
+			emit_pop(rDE, os);
+			os << LD << "(" << rHL << ")," << rE << std::endl;
+			emit_inc(rHL, os);
+			os << LD << "(" << rHL << ")," << rD << std::endl;
+			emit_pop(rHL, os);
+			if (*src.reg() == rHL) {
+				os << EX << rDE << "," << rHL << std::endl;
+			}
 	} else {
 			assert (dst.loc().kind() == MemoryLocation::Kind::PTR_OFF);
 			const RegisterPointerOffset& ptr_off = (const RegisterPointerOffset&) dst.loc();
@@ -149,6 +193,17 @@ void emit_load(const RegisterValue& dst, const MemoryValue& src, std::ostream& o
 			std::cerr << "invalid size of dst" << std::endl;
 			throw "invalid size of dst";
 		}
+	} else if (src.loc().kind() == MemoryLocation::Kind::PTR_FAR
+	           || src.loc().kind() == MemoryLocation::Kind::PTR_MEM) {
+		// HL = reg+offset, then load; only the destination changes
+		assert (*dst.reg() == rHL);
+		emit_push(rDE, os);
+		emit_far_address(src.loc(), os);
+		os << LD << rE << ",(" << rHL << ")" << std::endl;
+		emit_inc(rHL, os);
+		os << LD << rD << ",(" << rHL << ")" << std::endl;
+		os << EX << rDE << "," << rHL << std::endl;
+		emit_pop(rDE, os);
 	}	else {
 		std::cerr << "unknown type of memory location" << std::endl;
 		throw "unknown type of memory location";
@@ -163,6 +218,9 @@ void emit_neg(const Register& dst, std::ostream& s) {
 		emit_load(dst, ACC, s);
 	} else if (dst.size() == 2) {
 		const Register16& reg = (const Register16&) dst;
+		if (emit_template(std::string("neg ") + reg.name(), s)) {
+			return;
+		}
 		emit_load(ACC, reg.low(), s);
 		s << CPL << std::endl;
 		emit_load(reg.low(), ACC, s);
@@ -204,6 +262,35 @@ void emit_add(const RegisterValue& dst, const Immediate8& src, std::ostream& s)
 	s << ADD << dst << "," << src << std::endl;
 }
 
+// HL += n, changing A but neither DE nor BC
+void emit_add_hl(int16_t n, std::ostream& s) {
+	if (n >= 0 && n <= 4) {
+		for (int i = 0; i < n; ++i) {
+			emit_inc(rHL, s);
+		}
+	} else if (n > 0 && n <= UINT8_MAX) {
+		s << LD << rA << "," << n << std::endl;
+		s << ADD << rA << "," << rL << std::endl;
+		s << LD << rL << "," << rA << std::endl;
+		s << ADC << rA << "," << rH << std::endl;
+		s << SUB << rL << std::endl;
+		s << LD << rH << "," << rA << std::endl;
+	} else {
+		emit_push(rDE, s);
+		emit_load(RegisterValue(rDE), Immediate16(n), s);
+		emit_add(rHL, rDE, s);
+		emit_pop(rDE, s);
+	}
+}
+
+// HL = (HL), changing A
+void emit_load_hl_indirect(std::ostream& s) {
+	s << LD << rA << ",(" << rHL << ")" << std::endl;
+	emit_inc(rHL, s);
+	s << LD << rH << ",(" << rHL << ")" << std::endl;
+	s << LD << rL << "," << rA << std::endl;
+}
+
 void emit_add(const RegisterValue& dst, const MemoryValue& src, std::ostream& s) {
 	assert (dst.reg() && *dst.reg() == ACC);
 	if (src.loc().kind() == MemoryLocation::Kind::PTR) assert (src.reg() && *src.reg() == rHL);
@@ -353,6 +440,12 @@ void emit_copy(std::ostream& s) {
 	emit_call(addr, NULL, s);
 }
 
+// copy of an object of the given size (see CgenKlassTable::CgenCopyRoutines)
+void emit_copy(int size, std::ostream& s) {
+	AbsoluteAddress addr(std::string(COPY_PREFIX) + std::to_string(size));
+	emit_call(addr, NULL, s);
+}
+
 void emit_gc_assign(std::ostream& s) {
 	AbsoluteAddress addr("_GenGC_Assign");
 	emit_call(addr, NULL, s);
@@ -363,6 +456,11 @@ void emit_equality_test(std::ostream& s) {
 	emit_call(addr, NULL, s);
 }
 
+void emit_string_equality_test(std::ostream& s) {
+	AbsoluteAddress addr("String.equal_");
+	emit_call(addr, NULL, s);
+}
+
 void emit_case_abort(std::ostream& s) {
 	AbsoluteAddress addr("_case_abort");
 	emit_call(addr, NULL, s);
@@ -412,6 +510,57 @@ void emit_pop(const Register& dst, std::ostream& s) {
   s << POP << dst << std::endl;
 }
 
+// The frame pointer is FP, or with -f iy-flags=1 the word FRAME_POINTER, so that IY
+// keeps pointing at TI-OS's flags. These leave HL alone and may change DE.
+void emit_push_frame(std::ostream& s) {
+	if (!cgen_iy_flags) {
+		emit_push(FP, s);
+		return;
+	}
+	s << EX << rDE << "," << rHL << std::endl;
+	emit_load(RegisterValue(rHL), MemoryValue(AbsoluteAddress(FRAME_POINTER)), s);
+	emit_push(rHL, s);
+	s << EX << rDE << "," << rHL << std::endl;
+}
+
+// frame pointer = SP - temps, and so is SP if there are temporaries
+void emit_set_frame(int temps, std::ostream& s) {
+	if (!cgen_iy_flags) {
+		emit_load(RegisterValue(FP), Immediate16(static_cast<int16_t>(-temps*WORD_SIZE)), s);
+		emit_add(FP, RegisterValue(SP), s);
+		if (temps > 0) {
+			emit_load(SP, FP, s);
+		}
+		return;
+	}
+	s << EX << rDE << "," << rHL << std::endl;
+	emit_load(RegisterValue(rHL), Immediate16(static_cast<int16_t>(-temps*WORD_SIZE)), s);
+	emit_add(rHL, RegisterValue(SP), s);
+	emit_load(MemoryValue(AbsoluteAddress(FRAME_POINTER)), RegisterValue(rHL), s);
+	if (temps > 0) {
+		emit_load(SP, rHL, s);
+	}
+	s << EX << rDE << "," << rHL << std::endl;
+}
+
+void emit_pop_frame(std::ostream& s) {
+	emit_pop_frame(false, s);
+}
+
+// ... or leave DE alone too, at the cost of an ex (sp),hl
+void emit_pop_frame(bool keep_de, std::ostream& s) {
+	if (!cgen_iy_flags) {
+		emit_pop(FP, s);
+	} else if (!keep_de) {
+		emit_pop(rDE, s);
+		emit_load(MemoryValue(AbsoluteAddress(FRAME_POINTER)), RegisterValue(rDE), s);
+	} else {
+		s << EX << "(" << SP << ")," << rHL << std::endl;
+		emit_load(MemoryValue(AbsoluteAddress(FRAME_POINTER)), RegisterValue(rHL), s);
+		emit_pop(rHL, s);
+	}
+}
+
 
 void emit_cp(const Register8& src, std::ostream& s) {
   s << CP << src << std::endl;
@@ -433,6 +582,20 @@ void emit_or(const RegisterPointer& src, std::ostream& s) {
 ///////////
 
 
+bool emit_template(const std::string& pattern, std::ostream& s) {
+	if (!CgenPassEnabled(PASS_TEMPLATES)) {
+		return false;
+	}
+	for (const EmitTemplate* t = emit_templates; t->pattern != nullptr; ++t) {
+		if (pattern == t->pattern) {
+			s << t->code;
+			++gCgenStats.templated;
+			return true;
+		}
+	}
+	return false;
+}
+
 // Fetch the integer value in an Int object.
 //
 void emit_fetch_int(const RegisterValue& dst, const MemoryValue& src, std::ostream& s) {
@@ -451,6 +614,9 @@ void emit_fetch_int(const RegisterValue& dst, const MemoryValue& src, std::ostre
 		int16_t offset = DEFAULT_OBJFIELDS * WORD_SIZE;
 		
 		assert (src_reg == rHL && dst_reg != src_reg); // make sure not loading to same register
+		if (emit_template(std::string("ld ") + dst_reg.name() + ",(hl+" + std::to_string(offset) + ")", s)) {
+			return;
+		}
 		
 		// find scrap register
 		std::set<const Register16 *> regs16;
@@ -501,6 +667,9 @@ void emit_store_int(const RegisterValue& src, const MemoryValue& dst, std::ostre
 		int16_t offset = DEFAULT_OBJFIELDS * WORD_SIZE;
 	
 		assert (dst_reg == rHL && src_reg != dst_reg);
+		if (emit_template(std::string("ld (hl+") + std::to_string(offset) + ")," + src_reg.name(), s)) {
+			return;
+		}
 		
 		// find scrap register
 		std::set<const Register16 *> regs16;
@@ -548,6 +717,9 @@ void emit_fetch_bool(const RegisterValue& dst, const MemoryValue& src, std::ostr
 	
 		// const RegisterPointer& src_loc = (const RegisterPointer&) src.loc();
 		assert (src_reg == rHL && dst_reg != src_reg);
+		if (emit_template(std::string("ld ") + dst_reg.name() + ",(hl+" + std::to_string(offset) + ")", s)) {
+			return;
+		}
 		
 		// find scrap register
 		std::set<const Register16 *> regs16;
@@ -693,32 +865,50 @@ std::string CgenRef(const StringEntry* entry) {
 }
 
 /**
- * Generate reference to label for Int constant
+ * Generate reference to label for Int constant (or its value, if tagged)
  * @param os std::ostream to write generated code to
  * @param entry Int constant
  * @return os
  */
 std::ostream& CgenRef(std::ostream& os, const Int16Entry* entry) {
+  if (TaggedInt(entry->value())) {
+    os << entry->value() + TAGGED_INT_BIAS;
+    return os;
+  }
   os << INTCONST_PREFIX << entry->id();
   return os;
 }
 std::string CgenRef(const Int16Entry* entry) {
+	if (TaggedInt(entry->value())) {
+		return std::to_string(entry->value() + TAGGED_INT_BIAS);
+	}
 	char s[CgenRef_strlen];
 	sprintf(s, "%s%lu", INTCONST_PREFIX, entry->id());
 	return std::string(s);
 }
 
+bool TaggedInt(int value) {
+  return cgen_tagged && value >= TAGGED_INT_MIN && value <= TAGGED_INT_MAX;
+}
+
 /**
- * Generate reference to label for Bool constant
+ * Generate reference to label for Bool constant (or its value, if tagged)
  * @param os std::ostream to write generated code to
  * @param entry Bool constant
  * @return os
  */
 std::ostream& CgenRef(std::ostream& os, bool entry) {
+  if (cgen_tagged) {
+    os << (entry ? TAGGED_TRUE : TAGGED_FALSE);
+    return os;
+  }
   os << BOOLCONST_PREFIX  << ((entry) ? 1 : 0);
   return os;
 }
 std::string CgenRef(bool entry) {
+	if (cgen_tagged) {
+		return std::to_string(entry ? TAGGED_TRUE : TAGGED_FALSE);
+	}
 	char s[CgenRef_strlen];
 	sprintf(s, "%s%d", BOOLCONST_PREFIX, (entry) ? 1 : 0);
 	return std::string(s);
@@ -0,0 +1,30 @@
+/* emit_templates.cc
+ * generated by pax/superopt (superopt > src/emit_templates.cc); do not edit
+ *
+ * cheaper equivalents of fixed sequences of the code generator, used by pass templates
+ * (see emit_template)
+ */
+
+#include "emit.h"
+
+namespace cool {
+
+const EmitTemplate emit_templates[] = {
+	// 12 -> 9 bytes, 81 -> 62 T-states
+	{ "ld bc,(hl+6)", "\tpush\thl\n\tld\tbc,6\n\tadd\thl,bc\n\tld\tc,(hl)\n\tinc\thl\n\tld\tb,(hl)\n\tpop\thl\n" },
+	// 12 -> 9 bytes, 81 -> 62 T-states
+	{ "ld de,(hl+6)", "\tpush\thl\n\tld\tde,6\n\tadd\thl,de\n\tld\te,(hl)\n\tinc\thl\n\tld\td,(hl)\n\tpop\thl\n" },
+	// 12 -> 11 bytes, 81 -> 77 T-states
+	{ "ld (hl+6),de", "\tpush\thl\n\tinc\thl\n\tinc\thl\n\tinc\thl\n\tinc\thl\n\tinc\thl\n\tinc\thl\n\tld\t(hl),e\n\tinc\thl\n\tld\t(hl),d\n\tpop\thl\n" },
+	// 9 -> 3 bytes, 43 -> 19 T-states
+	{ "sub hl,bc", "\tor\ta\n\tsbc\thl,bc\n" },
+	// 7 -> 6 bytes, 30 -> 24 T-states
+	{ "neg hl", "\tsub\ta\n\tsub\tl\n\tld\tl,a\n\tsbc\ta,a\n\tsub\th\n\tld\th,a\n" },
+	// 6 -> 5 bytes, 29 -> 27 T-states
+	{ "ld hl,-de", "\tsub\ta\n\tld\th,a\n\tld\tl,a\n\tsbc\thl,de\n" },
+	// 8 -> 5 bytes, 27 -> 18 T-states
+	{ "ld hl,c?3:2", "\tld\thl,1\n\trl\tl\n" },
+	{ nullptr, nullptr }
+};
+
+} // namespace cool
@@ -39,6 +39,7 @@ limitations under the License.
 
 #include <string>
 #include <iosfwd>
+#include <functional>
 
 #include "stringtab.h"
 #include "utilities.h"
@@ -53,12 +54,17 @@ class SemantEnv;
 class SemantError;
 
 class VariableEnvironment;
+struct CallConvention;
+class FrameSlots;
 
 /// Abstract base class for all AST Nodes
 class ASTNode {
  public:
   const SourceLoc& loc() const { return loc_; }
 
+  /// Profile site of a method, conditional, loop or dispatch (see CgenProfile), -1 if none
+  int profile_site() const { return profile_site_; }
+  void set_profile_site(int site) { profile_site_ = site; }
 
   /// Dump AST as a formatted tree readable by Cool compiler phases
   /// \param os Output stream
@@ -68,6 +74,7 @@ class ASTNode {
 
  protected:
   SourceLoc loc_ = 0;
+  int profile_site_ = -1;
 
   ASTNode() {}
   ASTNode(SourceLoc loc) : loc_(loc) {}
@@ -156,6 +163,7 @@ class Feature : public ASTNode {
   Symbol* decl_type() const { return decl_type_; }
 
   virtual void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) {};
+  virtual void Fold() {}
 
  protected:
   Symbol* name_;
@@ -180,8 +188,12 @@ class Method : public Feature {
   Formals::const_iterator formals_begin() const { return formals_->begin(); }
   Formals::const_iterator formals_end() const { return formals_->end(); }
 
+  Expression* body() const { return body_; }
+  void set_body(Expression* body) { body_ = body; }
+
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os);
+  void Fold() override;
 
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
@@ -201,8 +213,10 @@ class Attr : public Feature {
   bool attr() const override { return true; }
 
   Expression* init() const { return init_; }
+  void set_init(Expression* init) { init_ = init; }
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
+  void Fold() override;
 
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
@@ -223,7 +237,23 @@ class Expression : public ASTNode {
 
   virtual void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) {}
   virtual void CodeGen(VariableEnvironment& varEnv, std::ostream& os) {}
-  virtual int CalcTemps() { return 0; }
+  /// Give frame slots to the variables defined in this expression (see cgen_slots.cc)
+  virtual void AllocSlots(FrameSlots& slots);
+
+  /// Constant folding and algebraic simplification (see cgen_fold.cc)
+  /// \return Expression to replace this node with (possibly this node itself)
+  virtual Expression* Fold() { return this; }
+  /// True if evaluating the expression has no side effects and cannot fail
+  virtual bool Pure() const { return false; }
+  /// Apply f to each direct subexpression, in evaluation order
+  virtual void ForEachChild(const std::function<void(Expression*)>& f) {}
+  /// Replace each direct subexpression with f(subexpression), in evaluation order
+  virtual void MapChildren(const std::function<Expression*(Expression*)>& f) {}
+  /// Mark the dispatches whose value is the value of this expression as tail calls (see cgen_tail.cc)
+  virtual void MarkTailCalls() {}
+  /// Evaluate a Bool and jump to label if it is when, on the flags that decide it instead of a Bool
+  /// object (pass compare); false if this expression can't, without generating anything
+  virtual bool CodeGenBranch(bool when, int label, VariableEnvironment& varEnv, std::ostream& os) { return false; }
 
  protected:
   Symbol* type_;
@@ -236,9 +266,14 @@ class Assign : public Expression {
  public:
   static Assign* Create(Symbol* name, Expression* value, SourceLoc loc = 0);
 
+  Symbol* name() const { return name_; }
+
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return value_->CalcTemps(); }
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(value_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override { value_ = f(value_); }
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -257,17 +292,60 @@ class Dispatch : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override {
-    int max_temps = 0;
-    for (Expression* expr : *actuals_) { max_temps = std::max(max_temps, expr->CalcTemps()); }
-    return std::max(max_temps, receiver_->CalcTemps());
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override {
+    for (Expression* expr : *actuals_) { f(expr); }
+    f(receiver_);
+  }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    for (Expressions::size_type i = 0; i < actuals_->size(); ++i) { actuals_->set(i, f(actuals_->at(i))); }
+    receiver_ = f(receiver_);
   }
+  void MarkTailCalls() override;
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
+  Expression* receiver() const { return receiver_; }
+  Symbol* name() const { return name_; }
+  Expressions::size_type actuals_size() const { return actuals_->size(); }
+
+  /// Class whose implementation is called, if it is known at compile time (nullptr otherwise)
+  /// \param klass Class containing the dispatch (for SELF_TYPE receivers)
+  virtual const Symbol* DirectTarget(Klass* klass) const;
+
+  /// Evaluate a call of String.length into HL as an Int value, if it is lowered inline (see cgen_intrinsics.cc)
+  bool CodeGenIntValue(VariableEnvironment& varEnv, std::ostream& os);
+
+  /// Expand callee in place of the call (see cgen_inline.cc)
+  void set_inline(Method* callee, Klass* callee_klass) {
+    inline_ = callee;
+    inline_klass_ = callee_klass;
+  }
+  Method* inline_callee() const { return inline_; }
+  Klass* inline_klass() const { return inline_klass_; }
+
  protected:
   Expression* receiver_;
   Symbol* name_;
   Expressions* actuals_;
+  Method* inline_ = nullptr;
+  Klass* inline_klass_ = nullptr;
+  bool tail_ = false;
+  std::vector<int> inline_slots_; // frame slots of the actuals of an inlined call
+
+  /// Call the implementation in klass directly (static dispatch or devirtualized dispatch):
+  /// inline, as a tail call, or with CodeGenDirect
+  void CodeGenKnown(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os);
+  void CodeGenDirect(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os);
+  void CodeGenInline(VariableEnvironment& varEnv, std::ostream& os);
+  /// Lower a call of a library method inline or to its register entry, if it is one (see cgen_intrinsics.cc)
+  bool CodeGenIntrinsic(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os);
+  /// Evaluate the actuals and the receiver (into ACC) of a call (see cgen_args.cc)
+  void CodeGenActuals(const CallConvention& call, bool load, int return_label, VariableEnvironment& varEnv,
+                      std::ostream& os);
+  /// Reuse the caller's argument slots and jump to the callee (see cgen_tail.cc)
+  bool CanTailCall(const Symbol* klass, const VariableEnvironment& varEnv) const;
+  void CodeGenTail(const Symbol* klass, VariableEnvironment& varEnv, std::ostream& os);
 
   Dispatch(Expression* receiver, Symbol* name, Expressions* actuals, SourceLoc loc)
       : Expression(loc), receiver_(receiver), name_(name), actuals_(actuals) {}
@@ -283,6 +361,9 @@ class StaticDispatch : public Dispatch {
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
+  const Symbol* DirectTarget(Klass* klass) const override;
+  Symbol* dispatch_type() const { return dispatch_type_; }
+
  protected:
   Symbol* dispatch_type_;
 
@@ -299,7 +380,14 @@ class Cond : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return std::max(pred_->CalcTemps(), std::max(then_branch_->CalcTemps(), else_branch_->CalcTemps())); }
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(pred_); f(then_branch_); f(else_branch_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    pred_ = f(pred_);
+    then_branch_ = f(then_branch_);
+    else_branch_ = f(else_branch_);
+  }
+  void MarkTailCalls() override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -318,7 +406,13 @@ class Loop : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return std::max(pred_->CalcTemps(), body_->CalcTemps()); }
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(pred_); f(body_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    pred_ = f(pred_);
+    body_ = f(body_);
+  }
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -336,12 +430,14 @@ class Block : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override {
-    int max_temps = 0;
-    for (Expression* expr:*body_)
-      { max_temps = std::max(max_temps, expr->CalcTemps()); }
-    return max_temps;
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override {
+    for (Expression* expr : *body_) { f(expr); }
+  }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    for (Expressions::size_type i = 0; i < body_->size(); ++i) { body_->set(i, f(body_->at(i))); }
   }
+  void MarkTailCalls() override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -356,9 +452,22 @@ class Let : public Expression {
   static Let* Create(Symbol* name, Symbol* decl_type, Expression* init, Expression* body,
                      SourceLoc loc = 0);
 
+  Symbol* name() const { return name_; }
+  Expression* init() const { return init_; }
+  Expression* body() const { return body_; }
+  /// The body assigns the variable before reading it, so its initial value needn't be stored
+  void set_init_dead() { init_dead_ = true; }
+
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return std::max(init_->CalcTemps(), body_->CalcTemps()+1); }
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(init_); f(body_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    init_ = f(init_);
+    body_ = f(body_);
+  }
+  void MarkTailCalls() override;
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -366,6 +475,8 @@ class Let : public Expression {
   Symbol* decl_type_;
   Expression* init_;
   Expression* body_;
+  int slot_ = 0; // frame slot of the variable
+  bool init_dead_ = false;
 
   Let(Symbol* name, Symbol* decl_type, Expression* init, Expression* body, SourceLoc loc)
       : Expression(loc), name_(name), decl_type_(decl_type), init_(init), body_(body) {}
@@ -378,13 +489,16 @@ class Kase : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override {
-    int max_temps = 0;
-    for (KaseBranch* case_branch : *cases_) {
-      Expression* expr = (Expression*) (case_branch);
-      max_temps = std::max(max_temps, expr->CalcTemps()); }
-    return std::max(max_temps, input_->CalcTemps());
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override {
+    f(input_);
+    for (KaseBranch* branch : *cases_) { f((Expression*) branch); }
   }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    input_ = f(input_);
+    for (KaseBranch* branch : *cases_) { f((Expression*) branch); } // branches themselves stay
+  }
+  void MarkTailCalls() override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -400,17 +514,23 @@ class KaseBranch : public Expression {
  public:
   static KaseBranch* Create(Symbol* name, Symbol* decl_type, Expression* body, SourceLoc loc = 0);
 
+  Symbol* name() const { return name_; }
   Symbol* decl_type() const { return decl_type_; }
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return 1+body_->CalcTemps(); }
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(body_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override { body_ = f(body_); }
+  void MarkTailCalls() override;
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
   Symbol* name_;
   Symbol* decl_type_;
   Expression* body_;
+  int slot_ = 0; // frame slot of the variable
   
   KaseBranch(Symbol* name, Symbol* decl_type, Expression* body, SourceLoc loc)
       : Expression(loc), name_(name), decl_type_(decl_type), body_(body) {}
@@ -425,6 +545,8 @@ class Knew : public Expression {
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
+  Symbol* name() const { return name_; }
+
  protected:
   Symbol* name_;
 
@@ -438,9 +560,14 @@ class UnaryOperator : public Expression {
 
   static UnaryOperator* Create(UnaryKind kind, Expression* input, SourceLoc loc = 0);
 
+  UnaryKind kind() const { return kind_; }
+
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return input_->CalcTemps(); }
+  bool CodeGenBranch(bool when, int label, VariableEnvironment& varEnv, std::ostream& os) override;
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(input_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override { input_ = f(input_); }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -461,10 +588,19 @@ class BinaryOperator : public Expression {
                                 SourceLoc loc = 0);
 
   const char* KindAsString() const;
+  BinaryKind kind() const { return kind_; }
+  Expression* lhs() const { return lhs_; }
+  Expression* rhs() const { return rhs_; }
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
-  int CalcTemps() override { return std::max(lhs_->CalcTemps(), rhs_->CalcTemps()); }
+  bool CodeGenBranch(bool when, int label, VariableEnvironment& varEnv, std::ostream& os) override;
+  Expression* Fold() override;
+  void ForEachChild(const std::function<void(Expression*)>& f) override { f(lhs_); f(rhs_); }
+  void MapChildren(const std::function<Expression*(Expression*)>& f) override {
+    lhs_ = f(lhs_);
+    rhs_ = f(rhs_);
+  }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -472,6 +608,14 @@ class BinaryOperator : public Expression {
   Expression* lhs_;
   Expression* rhs_;
 
+  /// Multiplication or division by a constant without a runtime call, if possible (see cgen_arith.cc)
+  bool CodeGenReduced(VariableEnvironment& varEnv, std::ostream& os);
+  /// Evaluate the operands into HL (lhs) and BC (rhs)
+  void CodeGenOperands(VariableEnvironment& varEnv, std::ostream& os);
+  /// Evaluate a comparison into the flags
+  /// \return the condition (Flags::C or Flags::Z) that holds if the comparison is true
+  const char* CodeGenFlags(VariableEnvironment& varEnv, std::ostream& os);
+
   BinaryOperator(BinaryKind kind, Expression* lhs, Expression* rhs, SourceLoc loc)
       : Expression(loc), kind_(kind), lhs_(lhs), rhs_(rhs) {}
 };
@@ -481,8 +625,12 @@ class Ref : public Expression {
  public:
   static Ref* Create(Symbol* name, SourceLoc loc = 0);
 
+  Symbol* name() const { return name_; }
+
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
+  bool Pure() const override { return true; }
+  void AllocSlots(FrameSlots& slots) override;
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -498,6 +646,7 @@ class NoExpr : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
+  bool Pure() const override { return true; }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -515,6 +664,7 @@ class StringLiteral : public Expression {
   
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
+  bool Pure() const override { return true; }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
   friend std::ostream& operator<<(std::ostream& os, const StringLiteral* s) {
@@ -537,6 +687,7 @@ class IntLiteral : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
+  bool Pure() const override { return true; }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -554,6 +705,7 @@ class BoolLiteral : public Expression {
 
   void TypeCheck(InheritanceGraph& g, SemantEnv& env, Klass* klass) override;
   void CodeGen(VariableEnvironment& varEnv, std::ostream& os) override;
+  bool Pure() const override { return true; }
   void DumpTree(std::ostream& os, size_t level, bool with_types) const override;
 
  protected:
@@ -69,6 +69,9 @@ class ASTNodeVector {
   Elem* at(size_type i) { return data_.at(i); }
   Elem* back() { return data_.back(); }
 
+  /// Replace the i-th element (used by AST rewriting passes)
+  void set(size_type i, Elem* elem) { data_.at(i) = elem; }
+
   /**
    * @}
    * @name Iterators
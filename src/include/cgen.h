@@ -49,8 +49,17 @@ limitations under the License.
 #include <list>
 #include <set>
 #include <map>
-
-extern bool cgen_optimize;       // optimize switch for code generator
+#include <memory>
+#include <unordered_set>
+
+extern bool cgen_report;         // report optimization statistics
+extern int cgen_inline_growth;   // max. estimated code size growth from inlining (bytes)
+extern bool cgen_tagged;         // Ints and Bools held in pointer words where they fit
+extern bool cgen_iy_flags;       // frame pointer in memory, leaving IY = flags for TI-OS
+extern int cgen_int_cache_low;   // range of preallocated Ints returned by Int boxing (pass int-cache)
+extern int cgen_int_cache_high;  // ... (empty if high < low)
+extern bool cgen_profile_generate; // count entries, branches and receiver classes (see CgenProfile)
+extern const char* cgen_profile_use; // profile read back to guide optimization (pass profile), if any
 extern bool disable_reg_alloc;
 
 //
@@ -83,10 +92,6 @@ struct CgenLayout {
 	struct Object {
 		static const int8_t attribute_offset = 3 * WORD_SIZE;
 	};
-	
-	struct InheritanceTree {
-		static const int16_t entry_length = 2 * WORD_SIZE;
-	};
 };
 
 /**
@@ -95,6 +100,183 @@ struct CgenLayout {
  * @param os std::ostream to write generated code to
  */
  void Cgen(Program* program, std::ostream& os, const char *asm_path, const char *lib_path);
+
+/**
+ * Constant folding and algebraic simplification (pass fold)
+ * @param program Program AST node, rewritten in place
+ */
+ void CgenFold(Program* program);
+
+/**
+ * Evaluate loop-invariant subexpressions of while loops before the loop (pass licm)
+ * @param program Program AST node, rewritten in place
+ */
+ void CgenHoistInvariants(Program* program);
+
+/**
+ * Evaluate repeated computations within straight-line regions of a method once (pass lvn)
+ * @param program Program AST node, rewritten in place
+ */
+ void CgenValueNumbering(Program* program);
+
+/**
+ * Remove computations whose values are unused and stores that are overwritten before being
+ * read (pass dce)
+ * @param program Program AST node, rewritten in place
+ */
+ void CgenEliminateDead(Program* program);
+
+/**
+ * Mark small methods for inlining at direct call sites (pass inline)
+ * @param program Program AST node
+ */
+ void CgenInline(Program* program);
+
+/**
+ * Find the classes, initializers and methods reachable from Main.main (pass reach),
+ * so that code generation can leave out the rest
+ * @param program Program AST node
+ */
+ void CgenReach(Program* program);
+
+/**
+ * Mark dispatches in tail position of method bodies (pass tail-calls)
+ * @param program Program AST node
+ */
+ void CgenTailCalls(Program* program);
+
+/**
+ * Give each jr/jp to a label defined in code the shortest form that reaches it
+ * @param code generated assembly
+ * @param shorten also turn jp branches into jr (pass relax); otherwise only jr branches out of
+ * range are changed
+ * @return code with branches relaxed
+ */
+std::string CgenRelaxBranches(const std::string& code, bool shorten);
+
+/**
+ * Optimizations, each named for -f enable=NAME and -f disable=NAME (see cgen_passes.cc).
+ * Program passes run in this order before code generation; the others are choices made
+ * while generating code.
+ */
+enum CgenPass {
+	PASS_FOLD, PASS_LICM, PASS_LVN, PASS_DCE, PASS_INLINE, PASS_REACH, PASS_TAIL_CALLS, PASS_DISPTAB,
+	PASS_DEVIRTUALIZE, PASS_FRAME, PASS_STRENGTH, PASS_COPY, PASS_INT_CACHE, PASS_RELAX, PASS_TEMPLATES,
+	PASS_PROFILE, PASS_REG_ARGS, PASS_INTRINSICS, PASS_COMPARE,
+	PASS_COUNT
+};
+
+/**
+ * Select the passes of an optimization level
+ * @param level "0", "1", "2" or "s" (-O0, -O1, -O2, -Os)
+ * @return false if there is no such level
+ */
+bool CgenSetLevel(const std::string& level);
+
+/**
+ * Enable or disable a pass, whatever the level
+ * @return false if there is no such pass
+ */
+bool CgenSetPass(const std::string& name, bool enabled);
+
+/**
+ * Write the program to std::cerr after a program pass's turn, whether or not it runs
+ * @return false if there is no such program pass
+ */
+bool CgenSetDumpAfter(const std::string& name);
+
+bool CgenPassEnabled(CgenPass pass);
+
+/**
+ * Run the program passes before the class table is built (early), or the rest
+ * @param program Program AST node, rewritten in place
+ */
+void CgenRunPasses(Program* program, bool early);
+
+/**
+ * Report the time and changes of each enabled pass (with -R)
+ * @param codegen_ms time spent generating code, with the code generation passes
+ */
+void CgenReportPasses(std::ostream& os, double codegen_ms);
+
+/**
+ * What a method body needs of its activation record (see CgenFrameUse)
+ */
+struct FrameUse {
+	bool self = true;      // uses self, an attribute or new SELF_TYPE
+	bool formals = true;   // reads or assigns an argument
+};
+
+/**
+ * Find which parts of the usual prologue a method can do without (pass frame)
+ * @param method method about to be generated
+ * @param varEnv environment with the method's class's attributes bound
+ */
+FrameUse CgenFrameUse(Method* method, VariableEnvironment& varEnv);
+
+/**
+ * How a call passes its arguments (see cgen_args.cc). The receiver is always in HL.
+ */
+struct CallConvention {
+	int registers = 0;        // last arguments, in DE (the last one) and BC (the one before)
+	int stack = 0;            // the others, pushed first argument first
+	bool callee_pops = false; // the callee drops the pushed arguments, not the caller
+};
+
+/**
+ * Convention of calls to a method (pass reg-args); every implementation of a method name
+ * shares it, so that dynamic dispatch needn't know the callee
+ * @param name method name
+ * @param count number of arguments
+ */
+CallConvention CgenCallConvention(Symbol* name, int count);
+
+/**
+ * Optimization counters, printed to std::clog with -R
+ */
+struct CgenStats {
+	int folded = 0;          // expressions simplified by CgenFold
+	int reduced = 0;         // multiplications and divisions by constants done inline
+	int hoisted = 0;         // loop-invariant expressions evaluated before their loop
+	int numbered = 0;        // repeated computations evaluated once (see CgenValueNumbering)
+	int loads_removed = 0;   // variable loads left out because ACC already held the value
+	int dead_values = 0;     // computations whose unused value is no longer computed
+	int dead_stores = 0;     // stores to local variables overwritten before being read
+	int boxed = 0;           // Int results boxed by the preallocated Int table's routine
+	int copies = 0;          // copies of prototype objects done by size-specialized routines
+	int templated = 0;       // sequences replaced by their superoptimized templates
+	int dispatches = 0;      // dynamic dispatch sites
+	int devirtualized = 0;   // ... of which were turned into direct calls
+	int inlined = 0;         // call sites expanded inline
+	int inline_growth = 0;   // estimated code size growth from inlining (bytes)
+	int dead_methods = 0;    // methods not reachable from Main.main
+	int dead_inits = 0;      // initializers of classes never instantiated (nor their subclasses)
+	int dead_classes = 0;    // classes never instantiated (no prototype object or dispatch table)
+	int dead_data = 0;       // bytes of prototype objects and dispatch tables removed
+	int tail_calls = 0;      // calls in tail position turned into jumps
+	int tail_recursions = 0; // ... of which were self-recursive (no frame teardown)
+	int disptab_bytes = 0;   // size of the dispatch tables before compaction
+	int compact_bytes = 0;   // ... and after
+	int nested_slots = 0;    // frame slots with one per variable in scope
+	int frame_slots = 0;     // ... and shared by variables that are never live at once
+	int frameless = 0;       // methods without a frame pointer (see CgenFrameUse)
+	int unbound_self = 0;    // methods that don't rebind self
+	int shortened_branches = 0;  // jp branches relaxed to jr (see CgenRelaxBranches)
+	int lengthened_branches = 0; // jr branches out of range turned into jp
+	int profile_counters = 0;    // counters of an instrumented program (see CgenProfile)
+	int guarded = 0;             // dynamic dispatches calling their hot receiver's method directly
+	int hot_arms = 0;            // conditionals laid out for their then arm (see Cond::CodeGen)
+	int rotated_loops = 0;       // loops laid out with their test at the bottom
+	int register_args = 0;       // arguments passed in registers at call sites (see CgenCallConvention)
+	int unpushed_args = 0;       // ... of which the caller kept in DE or BC instead of on the stack
+	int intrinsics = 0;          // calls of library methods lowered inline or to a register entry
+	int unboxed_lengths = 0;     // ... of which were String.length results used as values, never boxed
+	int flag_branches = 0;       // conditions that jump on the flags of a comparison (see CodeGenBranch)
+	std::map<std::string,std::pair<int,int>> numbered_methods; // "Class.method" -> numbered, loads_removed
+
+	void Report(std::ostream& os) const;
+};
+extern CgenStats gCgenStats;
  
  // Forward declarations
  class CgenKlassTable;
@@ -139,28 +321,89 @@ struct CgenLayout {
       void print_entries() const;
    };
  
+ /**
+  * Frame slot allocation by interval coloring (see cgen_slots.cc)
+  *
+  * Expression::AllocSlots walks a method body (or attribute initializer) in
+  * evaluation order; each variable kept in the frame lives from its
+  * definition to its last use, or to the end of the outermost loop it is
+  * used in but defined outside of. Variables whose lifetimes don't overlap
+  * share a slot.
+  */
+ class FrameSlots {
+ public:
+  int Open(int* slot);                 // new variable, defined here; its slot is stored to *slot
+  void Bind(Symbol* name, int var);    // variable is in scope under name
+  void Unbind(Symbol* name);           // ... until here
+  void Use(Symbol* name);              // reads or assigns name (ignored if not a frame variable)
+  void BeginLoop();
+  void EndLoop();
+
+  /// Assign slots to all variables
+  /// \return number of slots in the frame
+  int Color();
+  /// Slots needed if every variable had its own slot for its whole scope
+  int nested() const { return max_open_; }
+
+ private:
+  struct Var {
+    int start;
+    int end;
+    int* slot;
+  };
+  std::vector<Var> vars_;
+  std::unordered_map<Symbol*,std::vector<int>> scope_;
+  std::vector<std::pair<int,std::set<int>>> loops_; // start and variables used in each enclosing loop
+  int pos_ = 0;
+  int open_ = 0;
+  int max_open_ = 0;
+};
+
+/**
+ * Location of a variable at FP+offset: (iy+d) if in reach, otherwise addressed through HL
+ * (always, with -f iy-flags=1)
+ */
+std::unique_ptr<MemoryLocation> FrameLocation(int offset);
+
  class VariableEnvironment {
  public:
- VariableEnvironment(Klass* klass): temporary_count_(0), temporary_max_count_(0), klass_(klass), init_type_(nullptr) {}
+ VariableEnvironment(Klass* klass): klass_(klass), init_type_(nullptr) {}
     
-  void Push(Symbol* var, MemoryLocation& offset) { vars_[var].push_back(offset.copy()); }
-  void Pop(Symbol* var) { vars_[var].pop_back(); }
+  void Push(Symbol* var, MemoryLocation& offset) { Forget(var); vars_[var].push_back(offset.copy()); }
+  void PushFrame(Symbol* var, int offset) { Push(var, *FrameLocation(offset)); }
+  void Pop(Symbol* var) { Forget(var); vars_[var].pop_back(); }
   MemoryLocation& Lookup(Symbol* var) { return *vars_[var].back(); }	// returns offset  
-  
-  int GetTemporaryCount() { return temporary_count_; }
-  int GetTemporaryMaxCount() { return temporary_max_count_; }
-  int IncTemporaryCount() {
-    temporary_max_count_ = std::max(++temporary_count_, temporary_max_count_);
-    return temporary_count_;
+
+  /**
+   * Record that ACC holds var's value at the current end of os (nullptr: nothing known);
+   * anything emitted to os afterwards invalidates this
+   */
+  void SetAcc(Symbol* var, std::ostream& os) { acc_var_ = var; acc_os_ = &os; acc_pos_ = os.tellp(); }
+  /** Variable whose value ACC holds at the current end of os, if known */
+  Symbol* AccHeld(std::ostream& os) const {
+     return (acc_os_ == &os && acc_pos_ != std::streampos(-1) && os.tellp() == acc_pos_) ? acc_var_ : nullptr;
   }
-  int DecTemporaryCount() { return --temporary_count_; }
-  int ResetTemporaryCount() { return (temporary_max_count_ = temporary_count_ = 0); }
   
-  int temporary_count_;
-  int temporary_max_count_;
   Klass* klass_;
   Symbol* init_type_; // only used for generating NoExpr's, but needs to be updated before every object initialization
+  Method* method_ = nullptr; // method being generated (nullptr in initializers and inlined bodies)
+  int method_entry_ = 0;      // label following the method's prologue, target of self-recursive tail calls
+  int method_temps_ = 0;      // number of temporaries in the method's frame
+  int method_args_ = 0;       // FP offset of the method's last argument passed on the stack
+  std::vector<int> method_formals_; // FP offset of each argument (-1: register argument not kept)
+  int method_pushed_ = 0;     // register arguments the prologue pushed, just below the return address
+  CallConvention method_call_;
+  bool keep_args_ = false;    // DE and BC hold register arguments (see Dispatch::CodeGenActuals)
+  bool method_frame_ = true;  // FP was saved and points to the method's frame
+  bool method_self_ = true;   // caller's self was saved and self rebound
   std::unordered_map<Symbol*,std::list<MemoryLocation*>> vars_;	// use list to encapsulate scopes 
+
+ private:
+  Symbol* acc_var_ = nullptr;
+  const std::ostream* acc_os_ = nullptr;
+  std::streampos acc_pos_ = -1;
+
+  void Forget(Symbol* var) { if (acc_var_ == var) acc_var_ = nullptr; } // var now names another location
 };
 
 
@@ -175,11 +418,36 @@ struct CgenLayout {
     typedef std::unordered_map<Symbol*,Symbol*> MethodInheritanceTable;
     
  CgenNode(Klass* klass, bool inheritable, bool basic) : InheritanceNode(klass, inheritable, basic), 
-       tag_(0), attrVarEnv_(klass), objectSize_(3*WORD_SIZE) {}
+       tag_(0), max_tag_(0), attrVarEnv_(klass), objectSize_(3*WORD_SIZE) {}
     ~CgenNode() {}
   
   int16_t tag() const { return tag_; }
+  /**
+   * Largest tag in this class's subtree; tags are assigned in preorder, so the class
+   * and its subclasses have exactly the tags tag()..max_tag()
+   */
+  int16_t max_tag() const { return max_tag_; }
+  /**
+   * The prototype object already holds every attribute's initial value, so objects of this
+   * class need no initializer call (see AttrInits)
+   */
+  bool EmptyInitializer();
+  /** Size of the class's objects in bytes, as given in the prototype object */
+  int ObjectSize() const;
   DispatchTable& dispTab() { return dispTab_; } 
+  const VariableEnvironment& attrVarEnv() const { return attrVarEnv_; }
+
+  /**
+   * Check whether any descendant of this class overrides a method
+   * @param method Method name
+   * @param impl Class whose implementation this class uses
+   */
+  bool OverriddenBelow(Symbol* method, const Symbol* impl) const;
+
+  /**
+   * Check whether a method defined by this class can be called (see CgenReach)
+   */
+  bool Reachable(Symbol* method) const { return dead_methods_.count(method) == 0; }
   
  private:
   /**
@@ -194,6 +462,7 @@ struct CgenLayout {
    * ordering requirement.
    */
   ClassTag tag_;
+  ClassTag max_tag_;
   
   /* stores base variable environment, including only attributes
      to be used during recursive code generation
@@ -204,6 +473,16 @@ struct CgenLayout {
   DispatchTable dispTab_;
   MethodInheritanceTable methodInheritanceTab_;
 
+  /* reachability (everything is reachable unless CgenReach finds otherwise) */
+  bool instantiated_ = true;   // objects of this class may exist at run time
+  bool initialized_ = true;    // attribute initializers may run (class or a subclass is instantiated)
+  std::unordered_set<Symbol*> dead_methods_; // methods defined by this class that are never called
+
+  /* compacted dispatch table: row of entries, indexed by selector color (see cgen_disptab.cc) */
+  std::vector<const DispatchEntry*> row_;
+  int row_offset_ = 0;         // index of the row's first entry in the shared table
+
+  ClassTag AssignTags(ClassTag tag);
   void CreateAttrVarEnv(int next_offset);
 
     /* dispatch table methods */
@@ -218,12 +497,33 @@ struct CgenLayout {
   
   void EmitPrototypeObject(std::ostream& os);
   
+  /* an attribute's initialization, as done by the flattened initializer of a class */
+  struct AttrInit {
+    CgenNode* owner;    // class declaring the attribute
+    Attr* attr;
+    bool in_prototype;  // the prototype object holds the initial value (no store needed)
+  };
+  /**
+   * Initialization of the attributes of this class and its ancestors, in the order the
+   * initializer does them (ancestors' first, which is also the order of the object's fields)
+   */
+  std::vector<AttrInit> AttrInits();
+  /**
+   * The stores of this class's own attributes are large and would be copied into several
+   * initializers, so they are a subroutine of their own instead (see EmitInitializer)
+   */
+  bool SharedAttrInit();
+  int InstantiatedBelow() const;
+
   void EmitInitializer(std::ostream& os);
+  void EmitAttrStore(const AttrInit& init, std::ostream& os);
   void EmitMethods(std::ostream& os);
-  
-  void EmitInheritanceInfo(std::ostream& os) const;
+  void EmitMethod(Method* method, std::ostream& os);
+  void EmitDeadMethods(std::ostream& os) const;
   
   friend class CgenKlassTable;
+  friend class ReachAnalysis;
+  friend class CgenProfile;
 };
 
 
@@ -245,7 +545,54 @@ class CgenKlassTable : public KlassTable<CgenNode> {
   std::pair<bool,int> InheritanceDistance(const CgenNode* node1, const CgenNode* node2) const;
   int InheritanceDepth(const CgenNode *node) const;
 
-	std::map<std::size_t, const CgenNode *> GetTags() const;
+  /**
+   * Class hierarchy analysis: find the single implementation a dynamic dispatch can reach
+   * @param klass Static type of the receiver
+   * @param method Method name
+   * @return Class defining the implementation, or nullptr if a subclass overrides it
+   */
+  const Symbol* DispatchTarget(Symbol* klass, Symbol* method) const;
+
+  /**
+   * Compact the dispatch tables (pass disptab): only selectors that are still dispatched
+   * through tables get a slot, slots are shared between classes (selector coloring), rows
+   * are overlapped in one table (row displacement) and entries drop the page byte
+   * @param program Program AST node
+   */
+  void CompactDispatchTables(Program* program);
+
+  /**
+   * Offset of a method's entry from the start of a dispatch table
+   * @param klass Static type of the receiver
+   * @param method Method name
+   */
+  int16_t DispatchOffset(Symbol* klass, Symbol* method);
+
+  /**
+   * Copy the prototype object in ACC, of a class known at compile time; with pass copy, small
+   * objects are copied by a routine specialized to their size (see CgenCopyRoutines)
+   * @param klass Class of the prototype object
+   */
+  void EmitCopy(Symbol* klass, std::ostream& os);
+
+  /**
+   * With tagged Ints, or with pass int-cache and a non-empty cgen_int_cache_low..high, Int results are
+   * boxed by EmitBoxInt once computed, instead of being stored into a copy of Int_protObj
+   * made beforehand
+   */
+  bool LateBoxing() const;
+  bool IntCache() const;
+
+  /**
+   * Box the Int value in DE into ACC: tagged if it fits (see _int_box), else an object of
+   * the preallocated table if the value is in its range (see CgenIntCache), else a new one
+   */
+  void EmitBoxInt(std::ostream& os);
+
+  /**
+   * Unbox the Int in ACC into HL (with tagged Ints, see _int_unbox)
+   */
+  void EmitUnboxInt(std::ostream& os) const;
 
   /**
    * Generate code for entire Cool program
@@ -256,12 +603,31 @@ class CgenKlassTable : public KlassTable<CgenNode> {
    */
    void CodeGen(std::ostream& os, const char *asm_path, const char *lib_path);
 
+  /**
+   * Emit code for class initializers
+   */
+  void CgenClassInits(std::ostream& os) const;
+
  private:
   /**
    * Symbol table (loaded after first pass of code generation).
    */
   AsmSymbolTable symtab_;
 
+  /* compacted dispatch tables (empty if not compacted) */
+  std::unordered_map<Symbol*,int> selector_color_;
+  std::vector<const DispatchEntry*> compact_table_;
+  bool compact_ = false;
+
+  /* object sizes copied by specialized routines (see EmitCopy) */
+  std::set<int> copy_sizes_;
+  void CgenCopyRoutines(std::ostream& os) const;
+
+  /* the boxing routine and table of preallocated Ints, if EmitBoxInt was used */
+  bool int_cache_used_ = false;
+  bool InIntCache(int value) const; // Int constant defined by CgenIntCache, not CgenConstants
+  void CgenIntCache(std::ostream& os);
+
   /**
    * Emit code to the start the .data segment and declare global names
    * @param os std::ostream to write generated code to
@@ -291,6 +657,7 @@ class CgenKlassTable : public KlassTable<CgenNode> {
    * Emit code for dispatch tables
    */
   void CgenDispatchTables(std::ostream& os) const;
+  void CgenCompactDispatchTables(std::ostream& os) const;
   
   /**
    * Emit code for prototype objects (except for predefined classes)
@@ -307,20 +674,15 @@ class CgenKlassTable : public KlassTable<CgenNode> {
    */
   void CgenClassObjTab(std::ostream& os) const;
   
-  /**
-   * Emit code for class initializers
-   */
-  void CgenClassInits(std::ostream& os) const;
-  
   /**
    * Emit code for class methods
    */
   void CgenClassMethods(std::ostream& os) const;
   
   /**
-   * Emit inheritance tree for case expressions
+   * Emit definitions that leave unreachable routines out of the runtime library
    */
-  void CgenInheritanceTree(std::ostream& os) const;
+  void CgenRuntimeOmissions(std::ostream& os) const;
 
   /**
    * Emit symbol table for assembled program (first pass).
@@ -329,6 +691,94 @@ class CgenKlassTable : public KlassTable<CgenNode> {
 
 };
 
+/**
+ * Profile-guided optimization (see cgen_profile.cc)
+ *
+ * Methods, conditionals, loops and dispatches are the profile's sites, numbered in source
+ * order. A method's counter counts its entries, a conditional's its then and else arms, a
+ * loop's its entries and iterations, and a dispatch has one per class of the receiver's
+ * static type's subtree, in tag order.
+ */
+class CgenProfile {
+ public:
+  /// Number the sites of the program, before anything rewrites it
+  void NumberSites(Program* program);
+  /// Give the sites their counters, once the classes have tags
+  void Layout(const CgenKlassTable& table);
+  /**
+   * Read the counters of an instrumented run (-f profile-use)
+   * @param path contents of the appvar (as dumped by a simulator) or its .8xv file
+   * @return false, after a warning, if it can't be read or is the profile of another program
+   */
+  bool Load(const char* path);
+  bool loaded() const { return !counts_.empty(); }
+
+  /// Counter i of node's site (0 without a profile)
+  uint32_t Count(const ASTNode* node, int i = 0) const;
+  /// Sum of the counters of node's site
+  uint64_t Total(const ASTNode* node) const;
+  /// Class of at least 3/4 of the receivers of a dispatch, nullptr if none
+  const CgenNode* HotReceiver(const Dispatch* dispatch) const;
+
+  /// Definitions for the runtime's counting routines (see profile.z80)
+  void EmitDefines(std::ostream& os) const;
+  /// Count an execution of counter i of node's site (with -f profile-generate)
+  void EmitCount(const ASTNode* node, int i, std::ostream& os) const;
+  /// Count the class of the receiver in ACC of a dispatch (with -f profile-generate)
+  void EmitReceiver(const Dispatch* dispatch, std::ostream& os) const;
+
+ private:
+  struct Site {
+    char kind;           // 'm'ethod, 'c'onditional, 'l'oop or 'd'ispatch
+    std::string id;      // "Class.method" for a method, "Class.feature#n" for its n-th site
+    Symbol* receiver;    // static type of a dispatch's receiver
+    int tag = 0;         // ... and its tag
+    int first = 0;       // first counter
+    int counters = 0;
+  };
+  std::vector<Site> sites_;
+  std::vector<const CgenNode*> classes_; // by tag
+  std::vector<uint32_t> counts_;
+  int counters_ = 0;
+  uint16_t check_ = 0; // of the numbering, saved with the counters
+
+  void NumberSites(Expression* expr, Klass* klass, const std::string& owner, int& n);
+  void AddSite(ASTNode* node, char kind, const std::string& id, Symbol* receiver);
+};
+extern CgenProfile gCgenProfile;
+
+/**
+ * Effect analysis of expressions and methods, memoized per method (see cgen_effects.cc)
+ */
+class Effects {
+ public:
+  /// What a piece of code may change
+  struct Region {
+    std::set<Symbol*> changed;   // variables assigned or bound in it
+    bool writes_attrs = false;   // an attribute of some object may be assigned
+  };
+
+  /**
+   * Evaluating expr has no side effects, can't fail and terminates
+   * @param klass class containing expr
+   * @param readable decides which variables (other than self) expr may read
+   * @param calls set if expr calls a user method (which may read attributes)
+   */
+  bool Pure(Expression* expr, Klass* klass, const std::function<bool(Symbol*)>& readable, bool& calls);
+  /// Evaluating expr may assign an attribute of some object
+  bool MayWriteAttrs(Expression* expr, Klass* klass);
+
+  Region Scan(Expression* region, Klass* klass);
+  /// expr is pure and has the same value wherever it is evaluated within the scanned region
+  bool Invariant(Expression* expr, const Region& region, Klass* klass);
+
+ private:
+  std::map<std::pair<const CgenNode*,Symbol*>,bool> pure_;     // method -> pure
+  std::map<std::pair<const CgenNode*,Symbol*>,bool> writes_;   // method -> may write attributes
+
+  bool PureMethod(CgenNode* node, Symbol* method);
+  bool WritingMethod(CgenNode* node, Symbol* method);
+};
 
 } // namespace cool
 
@@ -79,6 +79,11 @@ limitations under the License.
 #define DISPENT_PREFIX       "_dispTab."
 #define METHOD_SEP           "."
 #define CLASSINIT_SUFFIX     "_init"
+#define ATTRINIT_SUFFIX      "_attrInit"
+#define COPY_PREFIX          "_copy."
+#define INTCACHE             "_int_cache"
+#define BOXINT               "_box_int"
+#define FRAME_POINTER        "_frame_pointer"
 #define PROTOBJ_SUFFIX       "_protObj"
 #define OBJECTPROTOBJ        "Object_protObj"
 #define INTCONST_PREFIX      "int_const"
@@ -106,6 +111,16 @@ limitations under the License.
 #define INT_SLOTS         1
 #define BOOL_SLOTS        1
 
+//
+// tagged representation (cgen_tagged): objects are never below $4000 (the
+// app's page), so words in 1..$3FFF hold Bools and Ints directly
+//
+#define TAGGED_FALSE      2
+#define TAGGED_TRUE       3
+#define TAGGED_INT_BIAS   0x2000                      // word = value + bias
+#define TAGGED_INT_MIN    (4 - TAGGED_INT_BIAS)
+#define TAGGED_INT_MAX    (0x3FFF - TAGGED_INT_BIAS)
+
 // DIRECTIVES
 #define DW            "\t.dw\t"
 #define DB            "\t.db\t"
@@ -145,6 +160,7 @@ limitations under the License.
 #define POP  "\tpop\t"
 
 #define LD   "\tld\t"
+#define LDI  "\tldi"
 
 #define EX   "\tex\t"
 
@@ -157,6 +173,7 @@ limitations under the License.
 #define RLA  "\trla"
 #define RLCA "\trlca"
 #define RL   "\trl\t"
+#define RR   "\trr\t"
 
 #define NEG  "\tneg\t"
 #define CPL	 "\tcpl\t"
@@ -215,6 +232,8 @@ void emit_cpl(const Register& dst, std::ostream& s);
 void emit_add(const RegisterValue& dst, const RegisterValue& src, std::ostream& s);
 void emit_add(const RegisterValue& dst, const Immediate8& src, std::ostream& s);
 void emit_add(const RegisterValue& dst, const MemoryValue& src, std::ostream& s);
+void emit_add_hl(int16_t n, std::ostream& s);
+void emit_load_hl_indirect(std::ostream& s);
 void emit_adc(const RegisterValue& dst, const RegisterValue& src, std::ostream& s);
 void emit_adc(const RegisterValue& dst, const Immediate8& src, std::ostream& s);
 void emit_adc(const RegisterValue& dst, const MemoryValue& src, std::ostream& s);
@@ -234,8 +253,14 @@ void emit_return(Flag flag, std::ostream& s);
 void emit_call(const AbsoluteAddress& addr, Flag flag, std::ostream& s);
  void emit_bcall(const AbsoluteAddress& addr, std::ostream& s);
 void emit_copy(std::ostream& s);
+void emit_copy(int size, std::ostream& s);
+void emit_push_frame(std::ostream& s);
+void emit_set_frame(int temps, std::ostream& s);
+void emit_pop_frame(std::ostream& s);
+void emit_pop_frame(bool keep_de, std::ostream& s);
 void emit_gc_assign(std::ostream& s);
 void emit_equality_test(std::ostream& s);
+void emit_string_equality_test(std::ostream& s);
 void emit_case_abort(std::ostream& s);
 void emit_case_abort2(std::ostream& s);
 void emit_dispatch_abort(std::ostream& s);
@@ -261,6 +286,21 @@ void emit_store_bool(const RegisterValue& src, const MemoryValue& dst, std::ostr
  std::string get_init_ref(Symbol* sym);
  void emit_init(Symbol* classname, std::ostream& os);
 
+ bool TaggedInt(int value); // Int held in the pointer word, with cgen_tagged
+
+ // cheaper equivalent of a fixed sequence, found by pax/superopt (see emit_templates.cc)
+ struct EmitTemplate {
+   const char* pattern; // sequence replaced, e.g. "sub hl,bc"
+   const char* code;
+ };
+ extern const EmitTemplate emit_templates[]; // ends with { nullptr, nullptr }
+
+ /**
+  * Write the template for a sequence, with pass templates
+  * @return false if there's none, and the caller emits the sequence itself
+  */
+ bool emit_template(const std::string& pattern, std::ostream& s);
+
  std::ostream& CgenRef(std::ostream& os, const StringEntry* entry);
  std::string CgenRef(const StringEntry* entry);
  std::ostream& CgenRef(std::ostream& os, const Int16Entry* entry);
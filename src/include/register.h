@@ -72,6 +72,7 @@ extern const Register16 rHL;
 extern const Register16 &ARG0;
 extern const Register16 rBC;
 extern const Register16 rDE;
+extern const Register16 rAF;
 extern const Register16 rSP;
 extern const Register16& SP;
 extern const Register16X rIX;
@@ -98,7 +99,7 @@ class MemoryLocation {
   virtual std::ostream& print(std::ostream& os) const { return os; }
   virtual std::size_t size() const { return 2; }
   
-  enum Kind { NONE, ABS, PTR, PTR_OFF };
+  enum Kind { NONE, ABS, PTR, PTR_OFF, PTR_FAR, PTR_MEM };
   virtual Kind kind() const { throw "only specializations of MemoryLocation are allowed"; return NONE; }
   friend std::ostream& operator<<(std::ostream& os, const MemoryLocation& loc);
   virtual MemoryLocation &operator[](int offset) const { throw std::string("cannot subscript MemoryLocation base class"); }
@@ -156,6 +157,39 @@ class RegisterPointerOffset: public RegisterPointer {
   const uint8_t offset_;
 };
 
+// (reg+offset) for offsets beyond the 8-bit displacement of (ix+d)/(iy+d);
+// only 16-bit loads and stores through HL are supported (see emit_load)
+class RegisterPointerFar: public MemoryLocation {
+ public:
+  RegisterPointerFar(const Register16X& reg, int16_t offset): reg_(reg), offset_(offset) {}
+  RegisterPointerFar(const RegisterPointerFar& old): reg_(old.reg()), offset_(old.offset()) {}
+  ~RegisterPointerFar() {}
+  std::ostream& print(std::ostream& os) const override;
+  Kind kind() const override { return PTR_FAR; }
+  const Register16X& reg() const { return reg_; }
+  int16_t offset() const { return offset_; }
+ private:
+  const Register16X& reg_;
+  const int16_t offset_;
+};
+
+// (ptr+offset), ptr being a word in memory at label: the frame pointer with
+// -f iy-flags=1; as for RegisterPointerFar, only 16-bit loads and stores through
+// HL are supported (see emit_load)
+class MemoryPointerFar: public MemoryLocation {
+ public:
+  MemoryPointerFar(const std::string& label, int16_t offset): label_(label), offset_(offset) {}
+  MemoryPointerFar(const MemoryPointerFar& old): label_(old.label()), offset_(old.offset()) {}
+  ~MemoryPointerFar() {}
+  std::ostream& print(std::ostream& os) const override;
+  Kind kind() const override { return PTR_MEM; }
+  const std::string& label() const { return label_; }
+  int16_t offset() const { return offset_; }
+ private:
+  const std::string label_;
+  const int16_t offset_;
+};
+
 // values
 class Value {
  public:
@@ -73,6 +73,15 @@ namespace cool {
    
       /* load dispatch symbols into dispatch entries */
       root()->LoadDispatchSymbols(symtab_);
+
+      /* compact dispatch tables have no page byte, so all methods must be on the first page */
+      for (const DispatchEntry* entry : compact_table_) {
+         if (entry != nullptr && entry->addr_ >= 0x4000 + PAGE_SIZE) {
+            fprintf(stderr, "page: method %s" METHOD_SEP "%s is not on the first page; "
+                    "compile with -f disable=disptab.\n", entry->klass_->value().c_str(), entry->method_->value().c_str());
+            throw "program too large for compact dispatch tables";
+         }
+      }
 }
 
    void CgenNode::LoadDispatchSymbols(const AsmSymbolTable& symtab) {
@@ -28,6 +28,7 @@ const Register16 rHL("hl", rH, rL);
 const Register16 &ARG0 = rHL;
 const Register16 rBC("bc", rB, rC);
 const Register16 rDE("de", rD, rE);
+const Register16 rAF("af", rA, rNIL); // only pushed and popped
 const Register16 rSP("sp", rNIL, rNIL);
 const Register16& SP = rSP;
 const Register16X rIX("ix", rIXH, rIXL);
@@ -91,6 +92,16 @@ std::ostream& RegisterPointerOffset::print(std::ostream& os) const {
 	return os;
 }
 
+std::ostream& RegisterPointerFar::print(std::ostream& os) const {
+	os << reg_ << "+" << offset_;
+	return os;
+}
+
+std::ostream& MemoryPointerFar::print(std::ostream& os) const {
+	os << "(" << label_ << ")+" << offset_;
+	return os;
+}
+
 RegisterPointerOffset &RegisterPointerOffset::advanced(uint8_t d) const {
 	const uint8_t this_offset = offset();
 	const int new_offset = ((int) this_offset) + ((int) d);
@@ -171,6 +182,10 @@ MemoryLocation *MemoryLocation::copy() const {
   		return new RegisterPointer(*((RegisterPointer *) this));
   	case PTR_OFF:
   		return new RegisterPointerOffset(*((RegisterPointerOffset *) this));
+  	case PTR_FAR:
+  		return new RegisterPointerFar(*((RegisterPointerFar *) this));
+  	case PTR_MEM:
+  		return new MemoryPointerFar(*((MemoryPointerFar *) this));
   	default:
   		return nullptr;
   	}
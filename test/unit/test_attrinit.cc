@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "ast.h"
+#include "ast_consumer.h"
+#include "cgen.h"
+
+namespace cool {
+extern Symbol *Int, *Main, *main_meth, *Object;
+extern CgenKlassTable* gCgenKlassTable;
+}
+
+using namespace cool;
+
+// class A { a : Int <- let x : Int <- 3 in let y : Int <- 4 in x * 10 + y; };
+// class B inherits A {}; class C inherits A {};
+TEST(AttrInitTest, SharedInitializerKeepsLetsApart) {
+  InitCoolSymbols();
+  Symbol* x = gIdentTable.emplace("x");
+  Symbol* y = gIdentTable.emplace("y");
+  Symbol* A = gIdentTable.emplace("A");
+
+  auto literal = [](int16_t value) {
+    IntLiteral* lit = IntLiteral::Create(value);
+    lit->set_type(Int);
+    return lit;
+  };
+  auto ref = [](Symbol* name) {
+    Ref* r = Ref::Create(name);
+    r->set_type(Int);
+    return r;
+  };
+
+  BinaryOperator* mul = BinaryOperator::Create(BinaryOperator::BO_Mul, ref(x), literal(10));
+  mul->set_type(Int);
+  BinaryOperator* add = BinaryOperator::Create(BinaryOperator::BO_Add, mul, ref(y));
+  add->set_type(Int);
+  Let* let_y = Let::Create(y, Int, literal(4), add);
+  let_y->set_type(Int);
+  Let* let_x = Let::Create(x, Int, literal(3), let_y);
+  let_x->set_type(Int);
+
+  Features* a_features = Features::Create();
+  a_features->push_back(Attr::Create(gIdentTable.emplace("a"), Int, let_x));
+  Features* main_features = Features::Create();
+  main_features->push_back(Method::Create(main_meth, Formals::Create(), Object, literal(0)));
+  Klasses* klasses = Klasses::Create();
+  klasses->push_back(Klass::Create(A, Object, a_features, StringLiteral::Create("test.cl")));
+  klasses->push_back(Klass::Create(gIdentTable.emplace("B"), A, Features::Create(), StringLiteral::Create("test.cl")));
+  klasses->push_back(Klass::Create(gIdentTable.emplace("C"), A, Features::Create(), StringLiteral::Create("test.cl")));
+  klasses->push_back(Klass::Create(Main, Object, main_features, StringLiteral::Create("test.cl")));
+
+  CgenKlassTable klass_table(klasses);
+  gCgenKlassTable = &klass_table;
+  std::ostringstream os;
+  klass_table.CgenClassInits(os);
+  gCgenKlassTable = nullptr;
+
+  // A_attrInit stores x and y, both live until x * 10 + y, to different frame slots
+  const std::string code = os.str();
+  const std::size_t begin = code.find("A_attrInit:");
+  ASSERT_NE(std::string::npos, begin);
+  const std::string attr_init = code.substr(begin, code.find("ret", begin) - begin);
+  EXPECT_NE(std::string::npos, attr_init.find("(iy+0),l"));
+  EXPECT_NE(std::string::npos, attr_init.find("(iy+2),l"));
+}
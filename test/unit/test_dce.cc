@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "ast.h"
+#include "ast_consumer.h"
+#include "cgen.h"
+
+namespace cool {
+extern Symbol *Int, *IO, *Main, *main_meth, *Object, *out_int, *self, *SELF_TYPE;
+extern CgenKlassTable* gCgenKlassTable;
+}
+
+using namespace cool;
+
+// main() : Object { let x : Int in { x <- f(); x <- 2; out_int(x); } }
+TEST(DeadCodeTest, KeepsEffectsOfDeadStore) {
+  InitCoolSymbols();
+  Symbol* x = gIdentTable.emplace("x");
+  Symbol* f = gIdentTable.emplace("f");
+
+  auto call = [](Symbol* name, Expressions* actuals) {
+    Ref* receiver = Ref::Create(self);
+    receiver->set_type(SELF_TYPE);
+    Dispatch* dispatch = Dispatch::Create(receiver, name, actuals);
+    dispatch->set_type(Int);
+    return dispatch;
+  };
+
+  Dispatch* f_call = call(f, Expressions::Create());
+  Assign* dead = Assign::Create(x, f_call);
+  dead->set_type(Int);
+  IntLiteral* two = IntLiteral::Create(2);
+  two->set_type(Int);
+  Assign* live = Assign::Create(x, two);
+  live->set_type(Int);
+  Ref* read = Ref::Create(x);
+  read->set_type(Int);
+  Expressions* out_args = Expressions::Create();
+  out_args->push_back(read);
+  Dispatch* out = call(out_int, out_args);
+
+  Expressions* stmts = Expressions::Create();
+  stmts->push_back(dead);
+  stmts->push_back(live);
+  stmts->push_back(out);
+  Block* block = Block::Create(stmts);
+  block->set_type(Int);
+  Let* let = Let::Create(x, Int, NoExpr::Create(), block);
+  let->set_type(Int);
+
+  Features* features = Features::Create();
+  features->push_back(Method::Create(f, Formals::Create(), Int, call(out_int, Expressions::Create())));
+  features->push_back(Method::Create(main_meth, Formals::Create(), Object, let));
+  Klasses* klasses = Klasses::Create();
+  klasses->push_back(Klass::Create(Main, IO, features, StringLiteral::Create("test.cl")));
+  Program* program = Program::Create(klasses);
+
+  CgenKlassTable klass_table(klasses);
+  gCgenKlassTable = &klass_table;
+  const int dead_stores = gCgenStats.dead_stores;
+  CgenEliminateDead(program);
+  gCgenKlassTable = nullptr;
+
+  EXPECT_EQ(dead_stores + 2, gCgenStats.dead_stores); // x <- f() and the let's default value
+  std::vector<Expression*> kept;
+  let->body()->ForEachChild([&](Expression* child) { kept.push_back(child); });
+  ASSERT_EQ(3u, kept.size());
+  EXPECT_EQ(f_call, kept[0]);  // the call is still made, its value isn't stored
+  EXPECT_EQ(live, kept[1]);
+  EXPECT_EQ(out, kept[2]);
+}
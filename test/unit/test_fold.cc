@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "ast.h"
+#include "ast_consumer.h"
+#include "cgen.h"
+
+namespace cool {
+extern Symbol *Int, *Bool;
+}
+
+TEST(FoldTest, FoldsIntArithmetic) {
+  using namespace cool;
+  InitCoolSymbols();
+
+  IntLiteral* three = IntLiteral::Create(3);
+  IntLiteral* four = IntLiteral::Create(4);
+  three->set_type(Int);
+  four->set_type(Int);
+  BinaryOperator* mul = BinaryOperator::Create(BinaryOperator::BO_Mul, three, four);
+  mul->set_type(Int);
+
+  IntLiteral* folded = dynamic_cast<IntLiteral*>(mul->Fold());
+  ASSERT_NE(nullptr, folded);
+  EXPECT_EQ(12, folded->value());
+  EXPECT_EQ(Int, folded->type());
+  EXPECT_TRUE(gIntTable.has(12));
+}
+
+TEST(FoldTest, WrapsAt16Bits) {
+  using namespace cool;
+  InitCoolSymbols();
+
+  IntLiteral* max = IntLiteral::Create(32767);
+  IntLiteral* one = IntLiteral::Create(1);
+  max->set_type(Int);
+  one->set_type(Int);
+  BinaryOperator* add = BinaryOperator::Create(BinaryOperator::BO_Add, max, one);
+  add->set_type(Int);
+
+  IntLiteral* folded = dynamic_cast<IntLiteral*>(add->Fold());
+  ASSERT_NE(nullptr, folded);
+  EXPECT_EQ(-32768, folded->value());
+}
+
+TEST(FoldTest, SimplifiesIdentities) {
+  using namespace cool;
+  InitCoolSymbols();
+
+  Ref* x = Ref::Create(gIdentTable.emplace("x"));
+  x->set_type(Int);
+  IntLiteral* zero = IntLiteral::Create(static_cast<int16_t>(0));
+  zero->set_type(Int);
+  BinaryOperator* add = BinaryOperator::Create(BinaryOperator::BO_Add, x, zero);
+  add->set_type(Int);
+  EXPECT_EQ(x, add->Fold());
+
+  UnaryOperator* neg = UnaryOperator::Create(UnaryOperator::UO_Neg, x);
+  neg->set_type(Int);
+  UnaryOperator* negneg = UnaryOperator::Create(UnaryOperator::UO_Neg, neg);
+  negneg->set_type(Int);
+  EXPECT_EQ(x, negneg->Fold());
+}
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "stringtab.h"
+#include "cgen.h"
+
+using namespace cool;
+
+class FrameSlotsTest : public ::testing::Test {
+ protected:
+  SymbolTable<Symbol> names_;
+  Symbol *a_ = names_.emplace("a"), *b_ = names_.emplace("b"), *c_ = names_.emplace("c");
+  int slot_a_ = -1, slot_b_ = -1, slot_c_ = -1;
+};
+
+// let a in let b <- a in b: a is dead once b is defined
+TEST_F(FrameSlotsTest, SharesSlotAfterLastUse) {
+  FrameSlots slots;
+  slots.Bind(a_, slots.Open(&slot_a_));
+  slots.Use(a_);
+  slots.Bind(b_, slots.Open(&slot_b_));
+  slots.Use(b_);
+  slots.Unbind(b_);
+  slots.Unbind(a_);
+
+  EXPECT_EQ(1, slots.Color());
+  EXPECT_EQ(2, slots.nested());
+  EXPECT_EQ(slot_a_, slot_b_);
+}
+
+TEST_F(FrameSlotsTest, KeepsOverlappingVariablesApart) {
+  FrameSlots slots;
+  slots.Bind(a_, slots.Open(&slot_a_));
+  slots.Bind(b_, slots.Open(&slot_b_));
+  slots.Use(b_);
+  slots.Use(a_);
+  slots.Unbind(b_);
+  slots.Unbind(a_);
+
+  EXPECT_EQ(2, slots.Color());
+  EXPECT_NE(slot_a_, slot_b_);
+}
+
+// let a in while ... loop { a; let b in b } pool: a is live on every iteration
+TEST_F(FrameSlotsTest, VariableUsedInLoopLivesUntilItsEnd) {
+  FrameSlots slots;
+  slots.Bind(a_, slots.Open(&slot_a_));
+  slots.BeginLoop();
+  slots.Use(a_);
+  slots.Bind(b_, slots.Open(&slot_b_));
+  slots.Use(b_);
+  slots.Unbind(b_);
+  slots.EndLoop();
+  slots.Bind(c_, slots.Open(&slot_c_));
+  slots.Unbind(c_);
+  slots.Unbind(a_);
+
+  EXPECT_EQ(2, slots.Color());
+  EXPECT_NE(slot_a_, slot_b_);
+  EXPECT_EQ(slot_a_, slot_c_);
+}
+
+TEST_F(FrameSlotsTest, IgnoresNamesNotInFrame) {
+  FrameSlots slots;
+  slots.Use(a_); // attribute or formal
+  EXPECT_EQ(0, slots.Color());
+}